@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "batch.h"
+#include "utils.h"
+#include "stats.h"
+
+/* Exact and prefix patterns are bucketed by their first two letters, or
+ * by the first alone if the second is a '?', and patterns starting with
+ * a '?' go in the last bucket, which every word tries */
+#define LETTERS 26
+#define TWO_LETTER_BUCKETS (LETTERS * LETTERS)
+#define ONE_LETTER_BUCKET(letter) (TWO_LETTER_BUCKETS + (letter))
+#define WILD_BUCKET (TWO_LETTER_BUCKETS + LETTERS)
+#define BUCKET_COUNT (WILD_BUCKET + 1)
+
+/* The patterns of a batch arranged for the pass over the dictionary */
+typedef struct {
+    BatchPattern *patterns;
+    int *lengths;
+    int *bucketStarts;
+    int *bucketPatterns;
+    int *anywherePatterns;
+    uint32_t *anywhereLetters;
+    int anywhereCount;
+} BatchPlan;
+
+/**
+ * Finds the bucket of an exact or prefix pattern.
+ *
+ * Parameters:
+ *  pattern - the pattern
+ *
+ * Returns the bucket the pattern goes in
+ * */
+static int pattern_bucket(char *pattern) {
+    if (isalpha(pattern[0]) && isalpha(pattern[1])) {
+        return (tolower(pattern[0]) - 'a') * LETTERS +
+                tolower(pattern[1]) - 'a';
+    } else if (isalpha(pattern[0])) {
+        return ONE_LETTER_BUCKET(tolower(pattern[0]) - 'a');
+    }
+    return WILD_BUCKET;
+}
+
+/**
+ * Collects the letters of a text, ignoring case.
+ *
+ * Parameters:
+ *  text - the text
+ *
+ * Returns a set with bit n set if the text holds the nth letter
+ * */
+static uint32_t letter_set(const char *text) {
+    uint32_t letters = 0;
+    for (int i = 0; text[i]; i++) {
+        if (isalpha(text[i])) {
+            letters |= 1u << (tolower(text[i]) - 'a');
+        }
+    }
+    return letters;
+}
+
+/**
+ * Sorts the patterns of a batch into buckets.
+ *
+ * Parameters:
+ *  plan - the plan to fill in
+ *  patterns - the patterns of the batch
+ *  count - the number of patterns
+ *
+ * Returns nothing
+ * */
+static void make_plan(BatchPlan *plan, BatchPattern *patterns, int count) {
+    plan->patterns = patterns;
+    plan->lengths = (int*) malloc((count + 1) * sizeof(int));
+    plan->bucketStarts = (int*) calloc(BUCKET_COUNT + 1, sizeof(int));
+    plan->bucketPatterns = (int*) malloc((count + 1) * sizeof(int));
+    plan->anywherePatterns = (int*) malloc((count + 1) * sizeof(int));
+    plan->anywhereLetters = (uint32_t*) malloc((count + 1) *
+            sizeof(uint32_t));
+    plan->anywhereCount = 0;
+
+    for (int i = 0; i < count; i++) {
+        plan->lengths[i] = strlen(patterns[i].pattern);
+        if (patterns[i].mode == MATCH_ANYWHERE) {
+            plan->anywhereLetters[plan->anywhereCount] =
+                    letter_set(patterns[i].pattern);
+            plan->anywherePatterns[plan->anywhereCount++] = i;
+        } else {
+            plan->bucketStarts[pattern_bucket(patterns[i].pattern) + 1]++;
+        }
+    }
+    for (int bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+        plan->bucketStarts[bucket + 1] += plan->bucketStarts[bucket];
+    }
+
+    int *next = (int*) malloc(BUCKET_COUNT * sizeof(int));
+    memcpy(next, plan->bucketStarts, BUCKET_COUNT * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        if (patterns[i].mode != MATCH_ANYWHERE) {
+            plan->bucketPatterns[next[pattern_bucket(
+                    patterns[i].pattern)]++] = i;
+        }
+    }
+    free(next);
+}
+
+/**
+ * Tests a word against the exact and prefix patterns of one bucket.
+ *
+ * Parameters:
+ *  plan - the plan of the batch
+ *  bucket - the bucket to try
+ *  dict - the dictionary being searched
+ *  id - the id of the word
+ *
+ * Returns nothing, the word is added to every pattern it matches
+ * */
+static void match_bucket(BatchPlan *plan, int bucket, DictionaryWords *dict,
+        int id) {
+    int length = dict->wordInfo[id] & WORD_LENGTH_MASK;
+    for (int k = plan->bucketStarts[bucket];
+            k < plan->bucketStarts[bucket + 1]; k++) {
+        int i = plan->bucketPatterns[k];
+        BatchPattern *pattern = &plan->patterns[i];
+        if (pattern->mode == MATCH_EXACT ? length != plan->lengths[i] :
+                length < plan->lengths[i]) {
+            continue;
+        }
+        if (pattern->predicate(dict, id, pattern->query)) {
+            dict_words_add_id(pattern->matches, id);
+        }
+    }
+}
+
+void batch_match(DictionaryWords *dict, BatchPattern *patterns, int count) {
+    BatchPlan plan;
+    make_plan(&plan, patterns, count);
+    for (int i = 0; i < count; i++) {
+        patterns[i].matches = dict_words_init_matches(dict);
+    }
+
+    int rejected = 0;
+    for (int id = 0; id < dict->size; id++) {
+        /* Only words that are all letters can match anything */
+        if (!(dict->wordInfo[id] & WORD_ALPHA_BIT)) {
+            rejected++;
+            continue;
+        }
+        char *word = dict->folded + dict->offsets[id];
+        if (word[0]) {
+            int first = word[0] - 'a';
+            if (word[1]) {
+                match_bucket(&plan, first * LETTERS + word[1] - 'a', dict,
+                        id);
+            }
+            match_bucket(&plan, ONE_LETTER_BUCKET(first), dict, id);
+        }
+        match_bucket(&plan, WILD_BUCKET, dict, id);
+
+        if (plan.anywhereCount == 0) {
+            continue;
+        }
+        uint32_t wordLetters = dict->letterSigs[id];
+        for (int k = 0; k < plan.anywhereCount; k++) {
+            BatchPattern *pattern = &patterns[plan.anywherePatterns[k]];
+            if ((plan.anywhereLetters[k] & ~wordLetters) == 0 &&
+                    pattern->predicate(dict, id, pattern->query)) {
+                dict_words_add_id(pattern->matches, id);
+            }
+        }
+    }
+
+    stats_add(COUNT_WORDS_SCANNED, dict->size - rejected);
+    stats_add(COUNT_WORDS_REJECTED, rejected);
+
+    free(plan.lengths);
+    free(plan.bucketStarts);
+    free(plan.bucketPatterns);
+    free(plan.anywherePatterns);
+    free(plan.anywhereLetters);
+}
@@ -0,0 +1,31 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "common.h"
+#include "scan.h"
+
+/* One pattern of a batch and the words it matched */
+typedef struct {
+    char *pattern;
+    MatchMode mode;
+    WordPredicate predicate; /* tests a word against the pattern */
+    void *query; /* passed to the predicate untouched */
+    DictionaryWords *matches; /* filled in by batch_match */
+} BatchPattern;
+
+/**
+ * Matches every pattern of a batch in a single pass over the dictionary.
+ * Exact and prefix patterns are grouped by their leading letters so each
+ * word is only tested against the patterns that could match it, and
+ * anywhere patterns are skipped for words missing any of their letters.
+ *
+ * Parameters:
+ *  dict - the dictionary to search
+ *  patterns - the patterns of the batch
+ *  count - the number of patterns
+ *
+ * Returns nothing, each pattern's match set is in dictionary order
+ * */
+void batch_match(DictionaryWords *dict, BatchPattern *patterns, int count);
+
+#endif
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/* Where the search program is looked for by default */
+#define DEFAULT_SEARCH_PATH "./search"
+
+/* The dictionary sizes benchmarked when none are given */
+#define DEFAULT_SIZES {100000, 1000000, 10000000, 50000000}
+
+/* How many queries of each kind are timed per dictionary */
+#define DEFAULT_QUERIES 20
+
+/* How many times the load is timed, the median is reported */
+#define LOAD_RUNS 5
+
+/* How many generated words patterns are drawn from */
+#define SAMPLE_WORDS 1024
+
+/* The longest pattern made, and the longest word generated */
+#define MAX_PATTERN_LENGTH 32
+#define MAX_WORD_LENGTH 24
+
+/* The most arguments a search is run with */
+#define MAX_SEARCH_ARGUMENTS 64
+
+/* Relative frequency of word lengths 1 to 24 in an English word list */
+static const int lengthWeights[MAX_WORD_LENGTH] = {
+    1, 5, 25, 60, 100, 140, 160, 160, 140, 110, 80, 55,
+    35, 20, 12, 6, 3, 2, 1, 1, 1, 1, 1, 1
+};
+
+/* Relative frequency of the letters a to z in English text */
+static const int letterWeights[26] = {
+    82, 15, 28, 43, 127, 22, 20, 61, 70, 2, 8, 40, 24,
+    67, 75, 19, 1, 60, 63, 91, 28, 10, 24, 2, 20, 1
+};
+
+/* A kind of query the benchmark times */
+typedef struct {
+    char *name;
+    char *mode;
+    bool sort;
+} QueryKind;
+
+static const QueryKind queryKinds[] = {
+    {"exact", "-exact", false},
+    {"prefix", "-prefix", false},
+    {"anywhere", "-anywhere", false},
+    {"sort", "-prefix", true}
+};
+
+/* The benchmark settings from the command line */
+typedef struct {
+    char *searchPath;
+    char *directory;
+    int queries;
+    long *sizes;
+    int sizeCount;
+    char **extraArguments; /* passed on to every search */
+    int extraCount;
+} BenchOptions;
+
+/* A dictionary generated for the benchmark */
+typedef struct {
+    char filename[4096];
+    long words;
+    long bytes;
+    char samples[SAMPLE_WORDS][MAX_WORD_LENGTH + 1];
+    int sampleCount;
+} Dictionary;
+
+/* The generator state, xorshift64* */
+static uint64_t randomState = 0x9e3779b97f4a7c15ull;
+
+/**
+ * Draws the next pseudo random number, the same sequence on every run.
+ *
+ * Returns the number
+ * */
+static uint64_t next_random() {
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return randomState * 0x2545f4914f6cdd1dull;
+}
+
+/**
+ * Draws an index with probability proportional to its weight.
+ *
+ * Parameters:
+ *  weights - the weights
+ *  count - the number of weights
+ *
+ * Returns the index drawn
+ * */
+static int draw_weighted(const int *weights, int count) {
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        total += weights[i];
+    }
+    int point = next_random() % total;
+    for (int i = 0; i < count; i++) {
+        point -= weights[i];
+        if (point < 0) {
+            return i;
+        }
+    }
+    return count - 1;
+}
+
+/**
+ * Prints how to run the benchmark and exits.
+ *
+ * Returns nothing
+ * */
+static void print_usage() {
+    fprintf(stderr, "Usage: searchbench [-search path] [-queries N]"
+            " [-dir directory] [words...] [-- search options]\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Reads the command line.
+ *
+ * Parameters:
+ *  argc - the number of arguments
+ *  argv - the arguments
+ *  options - filled in from the arguments
+ *
+ * Returns nothing, exits on bad arguments
+ * */
+static void parse_bench_options(int argc, char **argv,
+        BenchOptions *options) {
+    static long defaultSizes[] = DEFAULT_SIZES;
+    options->searchPath = DEFAULT_SEARCH_PATH;
+    options->directory = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    options->queries = DEFAULT_QUERIES;
+    options->sizes = (long*) malloc(argc * sizeof(long));
+    options->sizeCount = 0;
+    options->extraArguments = NULL;
+    options->extraCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--")) {
+            options->extraArguments = argv + i + 1;
+            options->extraCount = argc - i - 1;
+            break;
+        } else if (i + 1 < argc && !strcmp(argv[i], "-search")) {
+            options->searchPath = argv[++i];
+        } else if (i + 1 < argc && !strcmp(argv[i], "-dir")) {
+            options->directory = argv[++i];
+        } else if (i + 1 < argc && !strcmp(argv[i], "-queries")) {
+            options->queries = atoi(argv[++i]);
+            if (options->queries < 1) {
+                print_usage();
+            }
+        } else {
+            char *end;
+            long size = strtol(argv[i], &end, 10);
+            if (*argv[i] == 0 || *end != 0 || size < 1) {
+                print_usage();
+            }
+            options->sizes[options->sizeCount++] = size;
+        }
+    }
+
+    if (options->extraCount > MAX_SEARCH_ARGUMENTS - 8) {
+        print_usage();
+    }
+    if (options->sizeCount == 0) {
+        options->sizes = defaultSizes;
+        options->sizeCount = sizeof(defaultSizes) / sizeof(long);
+    }
+}
+
+/**
+ * Writes a dictionary of random words with English like lengths and
+ * letters. Some words are capitalised and some end in "'s", as in a
+ * system word list, and a sample of the words is kept to make patterns.
+ *
+ * Parameters:
+ *  dict - where to record the file and the samples
+ *  directory - where to create the file
+ *  words - how many words to write
+ *
+ * Returns false if the file could not be written
+ * */
+static bool generate_dictionary(Dictionary *dict, char *directory,
+        long words) {
+    /* The search takes any argument with a '-' in it for an option */
+    snprintf(dict->filename, sizeof(dict->filename),
+            "%s/searchbench_%ld_%d.txt", directory, words, (int) getpid());
+    FILE *file = fopen(dict->filename, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    long sampleEvery = words / SAMPLE_WORDS + 1;
+    dict->words = words;
+    dict->bytes = 0;
+    dict->sampleCount = 0;
+    for (long i = 0; i < words; i++) {
+        char word[MAX_WORD_LENGTH + 4];
+        int length = draw_weighted(lengthWeights, MAX_WORD_LENGTH) + 1;
+        for (int k = 0; k < length; k++) {
+            word[k] = 'a' + draw_weighted(letterWeights, 26);
+        }
+        word[length] = 0;
+        if (i % sampleEvery == 0 && dict->sampleCount < SAMPLE_WORDS) {
+            strcpy(dict->samples[dict->sampleCount++], word);
+        }
+
+        uint64_t style = next_random() % 100;
+        if (style < 8) {
+            word[0] = toupper(word[0]);
+        } else if (style < 12) {
+            strcpy(word + length, "'s");
+        }
+        dict->bytes += fprintf(file, "%s\n", word);
+    }
+
+    return fclose(file) == 0;
+}
+
+/**
+ * Makes a pattern for a kind of query from a sampled word. Exact patterns
+ * are whole words, prefix patterns their first letters, anywhere patterns
+ * a piece from the middle and sort patterns one or two letters, so the
+ * sort has a large result to order. About a quarter of the letters of
+ * the longer patterns are turned into '?'.
+ *
+ * Parameters:
+ *  pattern - where to write the pattern
+ *  kind - the kind of query
+ *  dict - the dictionary with the sampled words
+ *
+ * Returns nothing
+ * */
+static void make_pattern(char *pattern, const QueryKind *kind,
+        Dictionary *dict) {
+    char *word = dict->samples[next_random() % dict->sampleCount];
+    int length = strlen(word);
+    int start = 0;
+    int patternLength = length;
+
+    if (!strcmp(kind->name, "prefix")) {
+        patternLength = 2 + next_random() % 3;
+    } else if (!strcmp(kind->name, "anywhere")) {
+        patternLength = 3 + next_random() % 2;
+    } else if (!strcmp(kind->name, "sort")) {
+        patternLength = 1 + next_random() % 2;
+    }
+    if (patternLength > length) {
+        patternLength = length;
+    }
+    if (!strcmp(kind->name, "anywhere")) {
+        start = next_random() % (length - patternLength + 1);
+    }
+
+    for (int i = 0; i < patternLength; i++) {
+        pattern[i] = word[start + i];
+        if (patternLength > 2 && next_random() % 4 == 0) {
+            pattern[i] = '?';
+        }
+    }
+    pattern[patternLength] = 0;
+}
+
+/**
+ * Runs the search program once with its output thrown away.
+ *
+ * Parameters:
+ *  options - the benchmark settings
+ *  arguments - the search arguments, without the program name
+ *  count - the number of arguments
+ *
+ * Returns the wall time taken in milliseconds, exits if the search fails
+ * */
+static double time_search(BenchOptions *options, char **arguments,
+        int count) {
+    char *argv[MAX_SEARCH_ARGUMENTS];
+    int argc = 0;
+    argv[argc++] = options->searchPath;
+    for (int i = 0; i < options->extraCount; i++) {
+        argv[argc++] = options->extraArguments[i];
+    }
+    for (int i = 0; i < count; i++) {
+        argv[argc++] = arguments[i];
+    }
+    argv[argc] = NULL;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        execv(options->searchPath, argv);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "searchbench: %s failed\n", options->searchPath);
+        exit(EXIT_FAILURE);
+    }
+    return (end.tv_sec - start.tv_sec) * 1e3 +
+            (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+/**
+ * qsort comparator for timings
+ *
+ * Parameters:
+ *  first - pointer to the first timing
+ *  second - pointer to the second timing
+ *
+ * Returns less than, equal to or greater than zero
+ * */
+static int compare_times(const void *first, const void *second) {
+    double difference = *(double*) first - *(double*) second;
+    return (difference > 0) - (difference < 0);
+}
+
+/**
+ * Picks a percentile out of sorted timings.
+ *
+ * Parameters:
+ *  times - the timings, sorted
+ *  count - the number of timings
+ *  percent - the percentile wanted
+ *
+ * Returns the timing at the percentile
+ * */
+static double percentile(double *times, int count, double percent) {
+    int index = (int) (percent / 100 * count + 0.999999) - 1;
+    return times[index < 0 ? 0 : index];
+}
+
+/**
+ * Times how long the search takes just to load the dictionary, by asking
+ * for a word longer than any in it.
+ *
+ * Parameters:
+ *  options - the benchmark settings
+ *  dict - the dictionary
+ *
+ * Returns the median load time in milliseconds
+ * */
+static double time_load(BenchOptions *options, Dictionary *dict) {
+    char pattern[MAX_WORD_LENGTH + 2];
+    memset(pattern, 'z', MAX_WORD_LENGTH + 1);
+    pattern[MAX_WORD_LENGTH + 1] = 0;
+    char *arguments[] = {"-exact", pattern, dict->filename};
+
+    double times[LOAD_RUNS];
+    for (int i = 0; i < LOAD_RUNS; i++) {
+        times[i] = time_search(options, arguments, 3);
+    }
+    qsort(times, LOAD_RUNS, sizeof(double), compare_times);
+    return times[LOAD_RUNS / 2];
+}
+
+/**
+ * Times the queries of one kind against a dictionary and prints a line
+ * of JSON with the results.
+ *
+ * Parameters:
+ *  options - the benchmark settings
+ *  dict - the dictionary
+ *  kind - the kind of query
+ *  loadTime - the dictionary's load time in milliseconds
+ *
+ * Returns nothing
+ * */
+static void bench_queries(BenchOptions *options, Dictionary *dict,
+        const QueryKind *kind, double loadTime) {
+    double *times = (double*) malloc(options->queries * sizeof(double));
+    double total = 0;
+    for (int i = 0; i < options->queries; i++) {
+        char pattern[MAX_PATTERN_LENGTH + 1];
+        make_pattern(pattern, kind, dict);
+        char *arguments[4];
+        int count = 0;
+        arguments[count++] = kind->mode;
+        if (kind->sort) {
+            arguments[count++] = "-sort";
+        }
+        arguments[count++] = pattern;
+        arguments[count++] = dict->filename;
+        times[i] = time_search(options, arguments, count);
+        total += times[i];
+    }
+    qsort(times, options->queries, sizeof(double), compare_times);
+
+    printf("{\"words\": %ld, \"bytes\": %ld, \"query\": \"%s\","
+            " \"queries\": %d, \"load_ms\": %.3f, \"p50_ms\": %.3f,"
+            " \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f,"
+            " \"queries_per_sec\": %.3f, \"words_per_sec\": %.0f}\n",
+            dict->words, dict->bytes, kind->name, options->queries,
+            loadTime, percentile(times, options->queries, 50),
+            percentile(times, options->queries, 90),
+            percentile(times, options->queries, 99),
+            times[options->queries - 1], options->queries / total * 1e3,
+            dict->words * options->queries / total * 1e3);
+    fflush(stdout);
+    free(times);
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options;
+    parse_bench_options(argc, argv, &options);
+    if (access(options.searchPath, X_OK) == -1) {
+        fprintf(stderr, "searchbench: \"%s\" can not be run\n",
+                options.searchPath);
+        return EXIT_FAILURE;
+    }
+
+    Dictionary *dict = (Dictionary*) malloc(sizeof(Dictionary));
+    for (int i = 0; i < options.sizeCount; i++) {
+        if (!generate_dictionary(dict, options.directory,
+                options.sizes[i])) {
+            fprintf(stderr, "searchbench: can not write \"%s\"\n",
+                    dict->filename);
+            unlink(dict->filename);
+            return EXIT_FAILURE;
+        }
+
+        double loadTime = time_load(&options, dict);
+        for (int k = 0; k < sizeof(queryKinds) / sizeof(QueryKind); k++) {
+            bench_queries(&options, dict, &queryKinds[k], loadTime);
+        }
+        unlink(dict->filename);
+    }
+
+    free(dict);
+    return EXIT_SUCCESS;
+}
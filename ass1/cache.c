@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "cache.h"
+#include "utils.h"
+
+/* How many hash chains the cache has, a power of two */
+#define CACHE_BUCKETS (2 * RESULT_CACHE_ENTRIES)
+
+/* One cached result, in its hash chain and in the list of results from
+ * the most to the least recently used */
+typedef struct CacheEntry CacheEntry;
+struct CacheEntry {
+    MatchMode mode;
+    bool sort;
+    char *pattern; /* folded to lower case */
+    uint32_t hash;
+    int *ids;
+    int count;
+    CacheEntry *chain;
+    CacheEntry *newer;
+    CacheEntry *older;
+};
+
+struct ResultCache {
+    pthread_mutex_t lock;
+    long generation;
+    CacheEntry *buckets[CACHE_BUCKETS];
+    CacheEntry *newest;
+    CacheEntry *oldest;
+    int size;
+    long idCount;
+};
+
+/**
+ * Hashes the key of a result with 32 bit FNV-1a, ignoring the case of the
+ * pattern.
+ *
+ * Parameters:
+ *  mode - how the pattern is matched
+ *  pattern - the pattern
+ *  sort - whether the result is sorted
+ *
+ * Returns the hash
+ * */
+static uint32_t hash_key(MatchMode mode, const char *pattern, bool sort) {
+    uint32_t hash = (2166136261u ^ (mode << 1 | sort)) * 16777619u;
+    for (const char *letter = pattern; *letter; letter++) {
+        hash = (hash ^ (unsigned char) tolower(*letter)) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Takes a result out of the list of results by use.
+ *
+ * Parameters:
+ *  cache - the cache
+ *  entry - the result
+ *
+ * Returns nothing
+ * */
+static void unlink_entry(ResultCache *cache, CacheEntry *entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+/**
+ * Puts a result at the most recently used end of the list.
+ *
+ * Parameters:
+ *  cache - the cache
+ *  entry - the result, not in the list
+ *
+ * Returns nothing
+ * */
+static void push_newest(ResultCache *cache, CacheEntry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+/**
+ * Drops a result from the cache and frees it.
+ *
+ * Parameters:
+ *  cache - the cache
+ *  entry - the result
+ *
+ * Returns nothing
+ * */
+static void remove_entry(ResultCache *cache, CacheEntry *entry) {
+    CacheEntry **link = &cache->buckets[entry->hash & (CACHE_BUCKETS - 1)];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+    unlink_entry(cache, entry);
+
+    cache->size--;
+    cache->idCount -= entry->count;
+    free(entry->pattern);
+    free(entry->ids);
+    free(entry);
+}
+
+/**
+ * Drops every result if a newer generation of the dictionary is searched,
+ * then remembers the generation. Generations only go up, so a search of
+ * an older one is still finishing on a replaced dictionary.
+ *
+ * Parameters:
+ *  cache - the cache, locked
+ *  generation - the generation searched
+ *
+ * Returns false if the generation searched is older than the cache's
+ * */
+static bool check_generation(ResultCache *cache, long generation) {
+    if (generation < cache->generation) {
+        return false;
+    }
+    if (generation > cache->generation) {
+        while (cache->oldest) {
+            remove_entry(cache, cache->oldest);
+        }
+        cache->generation = generation;
+    }
+    return true;
+}
+
+/**
+ * Finds a result in the cache.
+ *
+ * Parameters:
+ *  cache - the cache, locked
+ *  hash - the hash of the key
+ *  mode - how the pattern is matched
+ *  pattern - the pattern, in any case
+ *  sort - whether the result is sorted
+ *
+ * Returns the result, NULL if it isn't cached
+ * */
+static CacheEntry *find_entry(ResultCache *cache, uint32_t hash,
+        MatchMode mode, const char *pattern, bool sort) {
+    CacheEntry *entry = cache->buckets[hash & (CACHE_BUCKETS - 1)];
+    while (entry && (entry->hash != hash || entry->mode != mode ||
+            entry->sort != sort || strcasecmp(entry->pattern, pattern))) {
+        entry = entry->chain;
+    }
+    return entry;
+}
+
+ResultCache *result_cache_init() {
+    ResultCache *cache = (ResultCache*) malloc(sizeof(ResultCache));
+    memset(cache, 0, sizeof(ResultCache));
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+void result_cache_free(ResultCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    while (cache->oldest) {
+        remove_entry(cache, cache->oldest);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+DictionaryWords *result_cache_get(ResultCache *cache, long generation,
+        MatchMode mode, const char *pattern, bool sort,
+        DictionaryWords *source) {
+    uint32_t hash = hash_key(mode, pattern, sort);
+    DictionaryWords *matches = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *entry = check_generation(cache, generation) ?
+            find_entry(cache, hash, mode, pattern, sort) : NULL;
+    if (entry) {
+        unlink_entry(cache, entry);
+        push_newest(cache, entry);
+
+        /* Copied while locked, the entry may be dropped once unlocked */
+        matches = dict_words_init_matches(source);
+        if (entry->count) {
+            dict_words_reserve(matches, entry->count);
+            memcpy(matches->ids, entry->ids, entry->count * sizeof(int));
+            matches->size = entry->count;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return matches;
+}
+
+void result_cache_put(ResultCache *cache, long generation, MatchMode mode,
+        const char *pattern, bool sort, DictionaryWords *matches) {
+    if (matches->size > RESULT_CACHE_IDS) {
+        return;
+    }
+
+    /* Built before locking so other threads only wait for the links */
+    CacheEntry *entry = (CacheEntry*) malloc(sizeof(CacheEntry));
+    entry->mode = mode;
+    entry->sort = sort;
+    entry->pattern = strdup(pattern);
+    for (char *letter = entry->pattern; *letter; letter++) {
+        *letter = tolower(*letter);
+    }
+    entry->hash = hash_key(mode, pattern, sort);
+    entry->count = matches->size;
+    entry->ids = (int*) malloc((matches->size + 1) * sizeof(int));
+    if (matches->size) {
+        memcpy(entry->ids, matches->ids, matches->size * sizeof(int));
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (!check_generation(cache, generation)) {
+        pthread_mutex_unlock(&cache->lock);
+        free(entry->pattern);
+        free(entry->ids);
+        free(entry);
+        return;
+    }
+    CacheEntry *other = find_entry(cache, entry->hash, mode, pattern, sort);
+    if (other) {
+        /* Another thread found the same result meanwhile */
+        remove_entry(cache, other);
+    }
+    while (cache->oldest && (cache->size == RESULT_CACHE_ENTRIES ||
+            cache->idCount + entry->count > RESULT_CACHE_IDS)) {
+        remove_entry(cache, cache->oldest);
+    }
+
+    CacheEntry **bucket = &cache->buckets[entry->hash & (CACHE_BUCKETS - 1)];
+    entry->chain = *bucket;
+    *bucket = entry;
+    push_newest(cache, entry);
+    cache->size++;
+    cache->idCount += entry->count;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,74 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* How many results the cache keeps at most */
+#define RESULT_CACHE_ENTRIES 4096
+
+/* How many ids all the cached results hold at most together. A result
+ * bigger than this is never cached. */
+#define RESULT_CACHE_IDS (16 * 1024 * 1024)
+
+/* The id lists of recent results, keyed by mode, pattern ignoring case
+ * and sort flag. When full the least recently used result is dropped. */
+typedef struct ResultCache ResultCache;
+
+/**
+ * Makes an empty result cache. It is safe to use from several threads.
+ *
+ * Returns the cache, free with result_cache_free()
+ * */
+ResultCache *result_cache_init();
+
+/**
+ * Frees a result cache and every result in it.
+ *
+ * Parameters:
+ *  cache - the cache to free, may be NULL
+ *
+ * Returns nothing
+ * */
+void result_cache_free(ResultCache *cache);
+
+/**
+ * Looks up the result of a search. Results cached from an older
+ * generation of the dictionary are all dropped first, and a search of a
+ * generation older than the newest seen is never answered.
+ *
+ * Parameters:
+ *  cache - the cache
+ *  generation - the generation of the dictionary being searched
+ *  mode - how the pattern is matched
+ *  pattern - the pattern, in any case
+ *  sort - whether the ids are wanted in sorted order
+ *  source - the dictionary the ids refer to
+ *
+ * Returns a new match set over source holding a copy of the cached ids,
+ * or NULL if the result isn't cached
+ * */
+DictionaryWords *result_cache_get(ResultCache *cache, long generation,
+        MatchMode mode, const char *pattern, bool sort,
+        DictionaryWords *source);
+
+/**
+ * Caches the result of a search, dropping the least recently used
+ * results to make room. Results of a generation older than the newest
+ * seen are not kept.
+ *
+ * Parameters:
+ *  cache - the cache
+ *  generation - the generation of the dictionary that was searched
+ *  mode - how the pattern was matched
+ *  pattern - the pattern, in any case
+ *  sort - whether the ids are in sorted order
+ *  matches - the match set found, its ids are copied
+ *
+ * Returns nothing
+ * */
+void result_cache_put(ResultCache *cache, long generation, MatchMode mode,
+        const char *pattern, bool sort, DictionaryWords *matches);
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "collate.h"
+#include "utils.h"
+
+/* Buckets smaller than this are finished with an insertion sort */
+#define INSERTION_SORT_SIZE 32
+
+/* Past this many bytes of common prefix a bucket is finished with a
+ * comparison sort, which keeps the recursion shallow */
+#define MAX_RADIX_DEPTH 64
+
+/* Match sets smaller than this are sorted by comparing ranks */
+#define COMPARISON_SORT_SIZE 256
+
+/* Bits of a rank sorted on by each pass of the match sort */
+#define RANK_DIGIT_BITS 11
+#define RANK_DIGITS (1 << RANK_DIGIT_BITS)
+
+/**
+ * Compares two folded words from a given depth, then by id so equal words
+ * keep dictionary order.
+ *
+ * Parameters:
+ *  dict - the dictionary holding the words
+ *  first - the id of the first word
+ *  second - the id of the second word
+ *  depth - how many leading bytes are known to be equal
+ *
+ * Returns less than, equal to or greater than zero as for strcmp
+ * */
+static int compare_folded_from(DictionaryWords *dict, int first, int second,
+        int depth) {
+    int order = strcmp(dict->folded + dict->offsets[first] + depth,
+            dict->folded + dict->offsets[second] + depth);
+    return order ? order : first - second;
+}
+
+/* The depth handed to compare_deep_ids, qsort_r only passes one pointer */
+typedef struct {
+    DictionaryWords *dict;
+    int depth;
+} DeepCompare;
+
+/**
+ * qsort_r comparator for ids that share a long prefix
+ *
+ * Parameters:
+ *  first - pointer to the first id
+ *  second - pointer to the second id
+ *  context - the DeepCompare
+ *
+ * Returns less than, equal to or greater than zero as for strcmp
+ * */
+static int compare_deep_ids(const void *first, const void *second,
+        void *context) {
+    DeepCompare *deep = (DeepCompare*) context;
+    return compare_folded_from(deep->dict, *(int*) first, *(int*) second,
+            deep->depth);
+}
+
+/**
+ * Sorts ids by their folded words with an MSD radix sort, distributing on
+ * one byte at a time. Every distribution is stable, so ids given in
+ * increasing order stay in that order among equal words.
+ *
+ * Parameters:
+ *  dict - the dictionary holding the words
+ *  ids - the ids to sort, all sharing their first depth bytes
+ *  scratch - room for as many ids
+ *  count - the number of ids
+ *  depth - the byte to distribute on
+ *
+ * Returns nothing
+ * */
+static void radix_sort_ids(DictionaryWords *dict, int *ids, int *scratch,
+        int count, int depth) {
+    if (count < INSERTION_SORT_SIZE) {
+        for (int i = 1; i < count; i++) {
+            int id = ids[i];
+            int k = i;
+            while (k > 0 && compare_folded_from(dict, ids[k - 1], id,
+                    depth) > 0) {
+                ids[k] = ids[k - 1];
+                k--;
+            }
+            ids[k] = id;
+        }
+        return;
+    }
+    if (depth >= MAX_RADIX_DEPTH) {
+        DeepCompare deep = {dict, depth};
+        qsort_r(ids, count, sizeof(int), compare_deep_ids, &deep);
+        return;
+    }
+
+    int starts[257] = {0};
+    for (int i = 0; i < count; i++) {
+        starts[(unsigned char) dict->folded[dict->offsets[ids[i]] + depth]
+                + 1]++;
+    }
+    for (int byte = 0; byte < 256; byte++) {
+        starts[byte + 1] += starts[byte];
+    }
+
+    int next[256];
+    memcpy(next, starts, sizeof(next));
+    for (int i = 0; i < count; i++) {
+        scratch[next[(unsigned char) dict->folded[dict->offsets[ids[i]] +
+                depth]]++] = ids[i];
+    }
+    memcpy(ids, scratch, count * sizeof(int));
+
+    /* Bucket 0 holds the words that ended, which are all equal */
+    for (int byte = 1; byte < 256; byte++) {
+        int size = starts[byte + 1] - starts[byte];
+        if (size > 1) {
+            radix_sort_ids(dict, ids + starts[byte], scratch, size,
+                    depth + 1);
+        }
+    }
+}
+
+void collate_build(DictionaryWords *dict) {
+    if (dict->sortedIds != NULL) {
+        return;
+    }
+
+    dict->sortedIds = (int*) malloc((dict->size + 1) * sizeof(int));
+    dict->sortRanks = (int*) malloc((dict->size + 1) * sizeof(int));
+    int *scratch = (int*) malloc((dict->size + 1) * sizeof(int));
+    for (int id = 0; id < dict->size; id++) {
+        dict->sortedIds[id] = id;
+    }
+    radix_sort_ids(dict, dict->sortedIds, scratch, dict->size, 0);
+    free(scratch);
+
+    for (int rank = 0; rank < dict->size; rank++) {
+        dict->sortRanks[dict->sortedIds[rank]] = rank;
+    }
+}
+
+void collate_sort_matches(DictionaryWords *matches) {
+    int size = matches->size;
+    int *ids = matches->ids;
+    int *ranks = matches->source->sortRanks;
+
+    /* Sort the ranks rather than the ids, then turn them back into ids */
+    int *sorted = (int*) malloc((size + 1) * sizeof(int));
+    for (int i = 0; i < size; i++) {
+        sorted[i] = ranks[ids[i]];
+    }
+
+    if (size < COMPARISON_SORT_SIZE) {
+        qsort(sorted, size, sizeof(int), compare_ids);
+    } else {
+        /* LSD radix sort, a digit of the rank per pass */
+        int *scratch = (int*) malloc(size * sizeof(int));
+        int *counts = (int*) malloc((RANK_DIGITS + 1) * sizeof(int));
+        for (int shift = 0; (matches->source->size - 1) >> shift > 0;
+                shift += RANK_DIGIT_BITS) {
+            memset(counts, 0, (RANK_DIGITS + 1) * sizeof(int));
+            for (int i = 0; i < size; i++) {
+                counts[((sorted[i] >> shift) & (RANK_DIGITS - 1)) + 1]++;
+            }
+            for (int digit = 0; digit < RANK_DIGITS; digit++) {
+                counts[digit + 1] += counts[digit];
+            }
+            for (int i = 0; i < size; i++) {
+                scratch[counts[(sorted[i] >> shift) &
+                        (RANK_DIGITS - 1)]++] = sorted[i];
+            }
+            int *swap = sorted;
+            sorted = scratch;
+            scratch = swap;
+        }
+        free(scratch);
+        free(counts);
+    }
+
+    for (int i = 0; i < size; i++) {
+        ids[i] = matches->source->sortedIds[sorted[i]];
+    }
+    free(sorted);
+}
+
+/**
+ * Moves a rank down a max heap of ranks until it is no smaller than
+ * either child.
+ *
+ * Parameters:
+ *  heap - the heap
+ *  size - how many ranks are in the heap
+ *  node - where the rank to move is
+ *
+ * Returns nothing
+ * */
+static void sift_down(int *heap, int size, int node) {
+    int rank = heap[node];
+    int child;
+    while ((child = 2 * node + 1) < size) {
+        if (child + 1 < size && heap[child + 1] > heap[child]) {
+            child++;
+        }
+        if (heap[child] <= rank) {
+            break;
+        }
+        heap[node] = heap[child];
+        node = child;
+    }
+    heap[node] = rank;
+}
+
+void collate_top_matches(DictionaryWords *matches, int limit) {
+    if (matches->size <= limit) {
+        collate_sort_matches(matches);
+        return;
+    }
+    int *ranks = matches->source->sortRanks;
+
+    /* A max heap of the smallest ranks seen, the largest of them on top to
+     * be replaced by any smaller one */
+    int *heap = (int*) malloc(limit * sizeof(int));
+    for (int i = 0; i < limit; i++) {
+        heap[i] = ranks[matches->ids[i]];
+    }
+    for (int node = limit / 2 - 1; node >= 0; node--) {
+        sift_down(heap, limit, node);
+    }
+    for (int i = limit; i < matches->size; i++) {
+        int rank = ranks[matches->ids[i]];
+        if (rank < heap[0]) {
+            heap[0] = rank;
+            sift_down(heap, limit, 0);
+        }
+    }
+
+    qsort(heap, limit, sizeof(int), compare_ids);
+    for (int i = 0; i < limit; i++) {
+        matches->ids[i] = matches->source->sortedIds[heap[i]];
+    }
+    matches->size = limit;
+    free(heap);
+}
@@ -0,0 +1,44 @@
+#ifndef COLLATE_H_
+#define COLLATE_H_
+
+#include "common.h"
+
+/**
+ * Works out where every word of a dictionary goes in sorted order, the
+ * order -sort prints in: words compared ignoring case, with words that
+ * only differ in case kept in dictionary order. The folded arena is
+ * sorted with an MSD radix sort once, so sorting matches later only
+ * means ordering ids by rank. Does nothing if the ranks already exist.
+ *
+ * Parameters:
+ *  dict - the normalized dictionary to rank
+ *
+ * Returns nothing
+ * */
+void collate_build(DictionaryWords *dict);
+
+/**
+ * Sorts a match set into the order of its dictionary's ranks, which
+ * collate_build() must have made.
+ *
+ * Parameters:
+ *  matches - the match set to sort
+ *
+ * Returns nothing
+ * */
+void collate_sort_matches(DictionaryWords *matches);
+
+/**
+ * Keeps only the first matches of a match set in sorted order, sorted.
+ * The ranks are picked with a heap as big as the limit, so the match set
+ * is never sorted in full.
+ *
+ * Parameters:
+ *  matches - the match set to cut down, its dictionary ranked
+ *  limit - how many matches to keep
+ *
+ * Returns nothing
+ * */
+void collate_top_matches(DictionaryWords *matches, int limit);
+
+#endif
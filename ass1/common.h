@@ -1,12 +1,75 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
-/* A structure that holds the words read from a file */
-typedef struct {
-    char **words;
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Optional query indexes a dictionary can carry */
+typedef struct LetterIndex LetterIndex;
+typedef struct Dawg Dawg;
+typedef struct FmIndex FmIndex;
+
+/* The ways a pattern can match a word */
+typedef enum {
+    MATCH_EXACT, MATCH_PREFIX, MATCH_ANYWHERE
+} MatchMode;
+
+/* A word's entry in wordInfo: its length and whether it is all letters */
+#define WORD_LENGTH_MASK 0x7fffffffu
+#define WORD_ALPHA_BIT 0x80000000u
+
+/* A structure that holds the words read from a file.
+ *
+ * The words live back to back in one arena, each ended by a newline or a
+ * null, and are found by their offset and the length in their wordInfo
+ * entry. A mapped arena is never written to. folded is a copy of the arena
+ * with the letters in lower case and each word null terminated, so a
+ * word's folded form is at the same offset. Bit n of letterSigs[id] is
+ * set when the word holds the nth letter, so words lacking a letter a
+ * pattern needs are ruled out with one test. A set of matches uses the
+ * same structure but only holds the ids of words in its source dictionary.
+ *
+ * Word ids are also grouped by length: the ids of words with length L are
+ * lengthIds[lengthStarts[L]] up to lengthIds[lengthStarts[L + 1]], in
+ * dictionary order.
+ *
+ * Once a dictionary is ranked for sorting, sortedIds lists the ids in
+ * sorted order and sortRanks[id] is the id's place in that list.
+ *
+ * Query indexes are only built for the backends that need them and are
+ * NULL otherwise. */
+typedef struct DictionaryWords DictionaryWords;
+struct DictionaryWords {
+    char *arena;
+    size_t arenaSize;
+    size_t arenaMemsize;
+    bool isArenaMapped; /* the arena is a file mapping, not malloc'd */
+    size_t *offsets;
+    uint32_t *wordInfo;
+    char *folded;
+    uint32_t *letterSigs;
+    int *ids;
+    DictionaryWords *source; /* the dictionary ids refer to, if a match set */
     int size;
-    int memsize;
-} DictionaryWords;
+    int memsize; /* the number of entries allocated */
+    int maxWordLength;
+    int *lengthStarts;
+    int *lengthIds;
+    int *sortRanks;
+    int *sortedIds;
+    LetterIndex *letterIndex;
+    Dawg *dawg;
+    FmIndex *fmIndex;
+    void *indexMapping; /* the index file the word arrays live in */
+    size_t indexMappingSize;
+    /* Which of the structures built lazily live in the index file, the
+     * rest were built on the heap after it was loaded */
+    bool isSortMapped;
+    bool isLetterIndexMapped;
+    bool isDawgMapped;
+    bool isFmIndexMapped;
+};
 
 
 
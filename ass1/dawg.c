@@ -0,0 +1,396 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "dawg.h"
+#include "utils.h"
+
+/* The most edges a node can have, one per letter */
+#define MAX_EDGES 26
+
+/* The number of nodes and edges the graph starts with room for */
+#define INITIAL_NODES 1024
+
+/* A node on the path of the last word added, still open for new edges.
+ * All its targets but the last are already registered. */
+typedef struct {
+    int edgeCount;
+    char letters[MAX_EDGES];
+    int targets[MAX_EDGES];
+    bool isFinal;
+} PathNode;
+
+/* The state needed while the graph is built */
+typedef struct {
+    Dawg *dawg;
+    int nodeMemsize;
+    int edgeMemsize;
+    int *register_;
+    int registerMemsize; /* always a power of two */
+} DawgBuilder;
+
+/**
+ * Orders two words by their case-folded forms.
+ *
+ * Parameters:
+ *  dict - the dictionary holding the words
+ *  first - the id of the first word
+ *  second - the id of the second word
+ *
+ * Returns less than, equal to or greater than 0 like strcmp
+ * */
+static int compare_folded_words(DictionaryWords *dict, int first,
+        int second) {
+    return strcmp(dict->folded + dict->offsets[first],
+            dict->folded + dict->offsets[second]);
+}
+
+/**
+ * Orders word ids by their case-folded words, keeping dictionary
+ * order between words that only differ by case.
+ *
+ * Parameters:
+ *  firstId - a pointer to the first id
+ *  secondId - a pointer to the second id
+ *  dict - the dictionary the ids refer to
+ *
+ * Returns less than, equal to or greater than 0 like strcmp
+ * */
+static int compare_folded_ids(const void *firstId, const void *secondId,
+        void *dict) {
+    int order = compare_folded_words(dict, *(int*) firstId,
+            *(int*) secondId);
+    return order ? order : *(int*) firstId - *(int*) secondId;
+}
+
+/**
+ * Hashes the contents of a node so equal nodes can be found
+ *
+ * Parameters:
+ *  isFinal - whether a word ends at the node
+ *  edgeCount - the number of edges
+ *  letters - the letter of each edge
+ *  targets - the node each edge leads to
+ *
+ * Returns the hash
+ * */
+static unsigned int hash_node(bool isFinal, int edgeCount, char *letters,
+        int *targets) {
+    unsigned int hash = isFinal ? 1 : 2;
+    for (int i = 0; i < edgeCount; i++) {
+        hash = hash * 31 + letters[i];
+        hash = hash * 2654435761u + targets[i];
+    }
+    return hash;
+}
+
+/**
+ * Checks whether a registered node has exactly the given contents
+ *
+ * Parameters:
+ *  dawg - the graph holding the node
+ *  node - the registered node
+ *  path - the contents to compare against
+ *
+ * Returns true if they are the same
+ * */
+static bool is_same_node(Dawg *dawg, int node, PathNode *path) {
+    int first = dawg->nodeFirstEdge[node];
+    if (dawg->nodeFinal[node] != path->isFinal ||
+            dawg->nodeFirstEdge[node + 1] - first != path->edgeCount) {
+        return false;
+    }
+    return !memcmp(dawg->edgeLetters + first, path->letters,
+            path->edgeCount) && !memcmp(dawg->edgeTargets + first,
+            path->targets, path->edgeCount * sizeof(int));
+}
+
+/**
+ * Doubles the register and puts every node back into it
+ *
+ * Parameters:
+ *  builder - the graph being built
+ *
+ * Returns nothing
+ * */
+static void grow_register(DawgBuilder *builder) {
+    Dawg *dawg = builder->dawg;
+    free(builder->register_);
+    builder->registerMemsize *= 2;
+    builder->register_ = (int*) malloc(builder->registerMemsize * sizeof(int));
+    memset(builder->register_, -1, builder->registerMemsize * sizeof(int));
+
+    for (int node = 0; node < dawg->nodeCount; node++) {
+        int first = dawg->nodeFirstEdge[node];
+        unsigned int slot = hash_node(dawg->nodeFinal[node],
+                dawg->nodeFirstEdge[node + 1] - first,
+                dawg->edgeLetters + first, dawg->edgeTargets + first);
+        slot &= builder->registerMemsize - 1;
+        while (builder->register_[slot] != -1) {
+            slot = (slot + 1) & (builder->registerMemsize - 1);
+        }
+        builder->register_[slot] = node;
+    }
+}
+
+/**
+ * Turns a path node into a registered node. If an equal node is already
+ * registered that one is reused, which is what shares the suffixes.
+ *
+ * Parameters:
+ *  builder - the graph being built
+ *  path - the finished path node
+ *
+ * Returns the id of the registered node
+ * */
+static int register_node(DawgBuilder *builder, PathNode *path) {
+    Dawg *dawg = builder->dawg;
+    unsigned int slot = hash_node(path->isFinal, path->edgeCount,
+            path->letters, path->targets) & (builder->registerMemsize - 1);
+    while (builder->register_[slot] != -1) {
+        if (is_same_node(dawg, builder->register_[slot], path)) {
+            return builder->register_[slot];
+        }
+        slot = (slot + 1) & (builder->registerMemsize - 1);
+    }
+
+    if (dawg->nodeCount + 2 > builder->nodeMemsize) {
+        builder->nodeMemsize *= 2;
+        dawg->nodeFirstEdge = (int*) realloc(dawg->nodeFirstEdge,
+                builder->nodeMemsize * sizeof(int));
+        dawg->nodeWords = (int*) realloc(dawg->nodeWords,
+                builder->nodeMemsize * sizeof(int));
+        dawg->nodeFinal = (bool*) realloc(dawg->nodeFinal,
+                builder->nodeMemsize * sizeof(bool));
+    }
+    if (dawg->edgeCount + path->edgeCount > builder->edgeMemsize) {
+        while (dawg->edgeCount + path->edgeCount > builder->edgeMemsize) {
+            builder->edgeMemsize *= 2;
+        }
+        dawg->edgeLetters = (char*) realloc(dawg->edgeLetters,
+                builder->edgeMemsize);
+        dawg->edgeTargets = (int*) realloc(dawg->edgeTargets,
+                builder->edgeMemsize * sizeof(int));
+    }
+
+    int node = dawg->nodeCount++;
+    int words = path->isFinal ? 1 : 0;
+    for (int i = 0; i < path->edgeCount; i++) {
+        dawg->edgeLetters[dawg->edgeCount + i] = path->letters[i];
+        dawg->edgeTargets[dawg->edgeCount + i] = path->targets[i];
+        words += dawg->nodeWords[path->targets[i]];
+    }
+    dawg->edgeCount += path->edgeCount;
+    dawg->nodeFinal[node] = path->isFinal;
+    dawg->nodeWords[node] = words;
+    dawg->nodeFirstEdge[node + 1] = dawg->edgeCount;
+    builder->register_[slot] = node;
+
+    /* Keep the register at most half full */
+    if (dawg->nodeCount * 2 > builder->registerMemsize) {
+        grow_register(builder);
+    }
+    return node;
+}
+
+/**
+ * Registers the nodes of the current path deeper than a depth, from the
+ * bottom up, hooking each one into its parent.
+ *
+ * Parameters:
+ *  builder - the graph being built
+ *  path - the path of the last word added
+ *  depth - the length of the last word added
+ *  keepDepth - the depth of the deepest node to stay open
+ *
+ * Returns nothing
+ * */
+static void close_path(DawgBuilder *builder, PathNode *path, int depth,
+        int keepDepth) {
+    for (int node = depth; node > keepDepth; node--) {
+        PathNode *parent = &path[node - 1];
+        parent->targets[parent->edgeCount - 1] = register_node(builder,
+                &path[node]);
+    }
+}
+
+/**
+ * Sorts the alphabetic words by their folded form and groups the ids
+ * of equal folded words into ranks.
+ *
+ * Parameters:
+ *  dawg - the graph to fill the ranks of
+ *  dict - the dictionary being indexed
+ *
+ * Returns nothing
+ * */
+static void build_ranks(Dawg *dawg, DictionaryWords *dict) {
+    dawg->rankIds = (int*) malloc((dict->size + 1) * sizeof(int));
+    int wordCount = 0;
+    for (int id = 0; id < dict->size; id++) {
+        if (dict->wordInfo[id] & WORD_ALPHA_BIT) {
+            dawg->rankIds[wordCount++] = id;
+        }
+    }
+    qsort_r(dawg->rankIds, wordCount, sizeof(int), compare_folded_ids, dict);
+
+    dawg->rankStarts = (int*) malloc((wordCount + 1) * sizeof(int));
+    dawg->rankCount = 0;
+    for (int i = 0; i < wordCount; i++) {
+        if (i == 0 || compare_folded_words(dict, dawg->rankIds[i - 1],
+                dawg->rankIds[i])) {
+            dawg->rankStarts[dawg->rankCount++] = i;
+        }
+    }
+    dawg->rankStarts[dawg->rankCount] = wordCount;
+}
+
+Dawg *dawg_build(DictionaryWords *dict) {
+    Dawg *dawg = (Dawg*) malloc(sizeof(Dawg));
+    memset(dawg, 0, sizeof(Dawg));
+    build_ranks(dawg, dict);
+
+    DawgBuilder builder;
+    builder.dawg = dawg;
+    builder.nodeMemsize = INITIAL_NODES;
+    builder.edgeMemsize = INITIAL_NODES;
+    builder.registerMemsize = INITIAL_NODES;
+    builder.register_ = (int*) malloc(INITIAL_NODES * sizeof(int));
+    memset(builder.register_, -1, INITIAL_NODES * sizeof(int));
+    dawg->nodeFirstEdge = (int*) malloc(INITIAL_NODES * sizeof(int));
+    dawg->nodeWords = (int*) malloc(INITIAL_NODES * sizeof(int));
+    dawg->nodeFinal = (bool*) malloc(INITIAL_NODES * sizeof(bool));
+    dawg->edgeLetters = (char*) malloc(INITIAL_NODES);
+    dawg->edgeTargets = (int*) malloc(INITIAL_NODES * sizeof(int));
+    dawg->nodeFirstEdge[0] = 0;
+
+    PathNode *path = (PathNode*) malloc((dict->maxWordLength + 1) *
+            sizeof(PathNode));
+    memset(&path[0], 0, sizeof(PathNode));
+    char *previous = "";
+    int previousLength = 0;
+
+    /* Words arrive in sorted order, so each one only shares a prefix with
+     * the path of the word before it and the rest of that path is final */
+    for (int rank = 0; rank < dawg->rankCount; rank++) {
+        int id = dawg->rankIds[dawg->rankStarts[rank]];
+        char *word = dict->folded + dict->offsets[id];
+        int length = dict->wordInfo[id] & WORD_LENGTH_MASK;
+
+        int common = 0;
+        while (common < length && common < previousLength &&
+                word[common] == previous[common]) {
+            common++;
+        }
+        close_path(&builder, path, previousLength, common);
+
+        for (int depth = common; depth < length; depth++) {
+            PathNode *parent = &path[depth];
+            parent->letters[parent->edgeCount] = word[depth];
+            parent->targets[parent->edgeCount] = -1;
+            parent->edgeCount++;
+            memset(&path[depth + 1], 0, sizeof(PathNode));
+        }
+        path[length].isFinal = true;
+        previous = word;
+        previousLength = length;
+    }
+    close_path(&builder, path, previousLength, 0);
+    dawg->root = register_node(&builder, &path[0]);
+
+    free(path);
+    free(builder.register_);
+    return dawg;
+}
+
+/**
+ * Adds the words with ranks in a range to a match set
+ *
+ * Parameters:
+ *  dawg - the word graph
+ *  firstRank - the first rank to add
+ *  endRank - one past the last rank to add
+ *  matches - the match set to add to
+ *
+ * Returns nothing
+ * */
+static void add_ranks(Dawg *dawg, int firstRank, int endRank,
+        DictionaryWords *matches) {
+    int first = dawg->rankStarts[firstRank];
+    int end = dawg->rankStarts[endRank];
+    dict_words_reserve(matches, matches->size + end - first);
+    memcpy(matches->ids + matches->size, dawg->rankIds + first,
+            (end - first) * sizeof(int));
+    matches->size += end - first;
+}
+
+/**
+ * Walks the graph from a node following the rest of the pattern
+ *
+ * Parameters:
+ *  dawg - the word graph
+ *  node - the node reached so far
+ *  rank - the rank of the first word at or below the node
+ *  pattern - the part of the pattern still to match
+ *  isPrefix - whether every word below the end of the pattern matches
+ *  matches - the match set to add to
+ *
+ * Returns the number of rank ranges added
+ * */
+static int walk(Dawg *dawg, int node, int rank, char *pattern,
+        bool isPrefix, DictionaryWords *matches) {
+    if (*pattern == 0) {
+        if (isPrefix && dawg->nodeWords[node]) {
+            add_ranks(dawg, rank, rank + dawg->nodeWords[node], matches);
+            return 1;
+        } else if (!isPrefix && dawg->nodeFinal[node]) {
+            add_ranks(dawg, rank, rank + 1, matches);
+            return 1;
+        }
+        return 0;
+    }
+
+    int ranges = 0;
+    char letter = tolower(*pattern);
+    rank += dawg->nodeFinal[node];
+    for (int edge = dawg->nodeFirstEdge[node];
+            edge < dawg->nodeFirstEdge[node + 1]; edge++) {
+        int target = dawg->edgeTargets[edge];
+        if (*pattern == '?' || dawg->edgeLetters[edge] == letter) {
+            ranges += walk(dawg, target, rank, pattern + 1, isPrefix,
+                    matches);
+        } else if (dawg->edgeLetters[edge] > letter) {
+            break;
+        }
+        rank += dawg->nodeWords[target];
+    }
+    return ranges;
+}
+
+DictionaryWords *dawg_match(Dawg *dawg, DictionaryWords *dict,
+        char *pattern, bool isPrefix) {
+    DictionaryWords *matches = dict_words_init_matches(dict);
+
+    /* Ranks are in alphabetical order, put the ids back in dictionary
+     * order unless they came from a single rank */
+    if ((walk(dawg, dawg->root, 0, pattern, isPrefix, matches) > 1 ||
+            isPrefix) && matches->size > 1) {
+        qsort(matches->ids, matches->size, sizeof(int), compare_ids);
+    }
+
+    return matches;
+}
+
+void dawg_free(Dawg *dawg) {
+    if (dawg == NULL) {
+        return;
+    }
+    free(dawg->nodeFirstEdge);
+    free(dawg->nodeWords);
+    free(dawg->nodeFinal);
+    free(dawg->edgeLetters);
+    free(dawg->edgeTargets);
+    free(dawg->rankStarts);
+    free(dawg->rankIds);
+    free(dawg);
+}
@@ -0,0 +1,68 @@
+#ifndef DAWG_H_
+#define DAWG_H_
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* A directed acyclic word graph: a trie of the case-folded alphabetic
+ * words with equal suffixes shared.
+ *
+ * Node n owns the edges from nodeFirstEdge[n] up to nodeFirstEdge[n + 1],
+ * sorted by letter. nodeWords[n] counts the words accepted at or below n,
+ * which gives every folded word its rank in sorted order while walking
+ * down. The dictionary ids of the words with rank r are rankIds[
+ * rankStarts[r]] up to rankIds[rankStarts[r + 1]], in dictionary order. */
+struct Dawg {
+    int root;
+    int nodeCount;
+    int *nodeFirstEdge;
+    int *nodeWords;
+    bool *nodeFinal;
+    int edgeCount;
+    char *edgeLetters;
+    int *edgeTargets;
+    int rankCount;
+    int *rankStarts;
+    int *rankIds;
+};
+
+/**
+ * Builds the word graph over all the alphabetic words in a dictionary.
+ * Words that only differ by case share one path. The dictionary must
+ * already be normalized.
+ *
+ * Parameters:
+ *  dict - the dictionary to build the graph from
+ *
+ * Returns the graph, free it with dawg_free()
+ * */
+Dawg *dawg_build(DictionaryWords *dict);
+
+/**
+ * Finds the words matching a pattern by walking the graph. Fixed letters
+ * follow a single edge and only '?' branches, so the cost depends on the
+ * part of the graph that matches rather than the size of the dictionary.
+ *
+ * Parameters:
+ *  dawg - the word graph of the dictionary
+ *  dict - the dictionary the graph was built from
+ *  pattern - the pattern of letters and '?' to match
+ *  isPrefix - whether longer words may match too, as with -prefix
+ *
+ * Returns the match set in dictionary order
+ * */
+DictionaryWords *dawg_match(Dawg *dawg, DictionaryWords *dict,
+        char *pattern, bool isPrefix);
+
+/**
+ * Frees all the memory held by the graph
+ *
+ * Parameters:
+ *  dawg - the graph to free
+ *
+ * Returns nothing
+ * */
+void dawg_free(Dawg *dawg);
+
+#endif
@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fmindex.h"
+#include "utils.h"
+
+/* The codes the text is written in */
+#define END_CODE 0
+#define SEPARATOR_CODE 1
+#define FIRST_LETTER_CODE 2
+
+/* What a backward search needs to report its matches */
+typedef struct {
+    FmIndex *index;
+    char *core; /* the pattern without leading and trailing '?' */
+    int coreLength;
+    int leading;
+    int trailing;
+    DictionaryWords *matches; /* holds word numbers, not ids, until done */
+} BackwardSearch;
+
+/**
+ * Writes the alphabetic words of a dictionary into one text of codes,
+ * each word followed by a separator and the text ended by END_CODE.
+ *
+ * Parameters:
+ *  index - the index to record the word starts in
+ *  dict - the dictionary being indexed
+ *
+ * Returns the text, index->textSize codes long, or NULL if it would be
+ * longer than FM_MAX_TEXT_SIZE
+ * */
+static uint8_t *build_text(FmIndex *index, DictionaryWords *dict) {
+    int64_t size = 1;
+    index->wordCount = 0;
+    index->wordIds = (int*) malloc((dict->size + 1) * sizeof(int));
+    for (int id = 0; id < dict->size; id++) {
+        if (dict->wordInfo[id] & WORD_ALPHA_BIT) {
+            index->wordIds[index->wordCount++] = id;
+            size += (dict->wordInfo[id] & WORD_LENGTH_MASK) + 1;
+        }
+    }
+    if (size > FM_MAX_TEXT_SIZE) {
+        free(index->wordIds);
+        return NULL;
+    }
+
+    uint8_t *text = (uint8_t*) malloc(size);
+    index->wordStarts = (int*) malloc((index->wordCount + 1) * sizeof(int));
+    int position = 0;
+    for (int k = 0; k < index->wordCount; k++) {
+        int id = index->wordIds[k];
+        char *word = dict->folded + dict->offsets[id];
+        int length = dict->wordInfo[id] & WORD_LENGTH_MASK;
+        index->wordStarts[k] = position;
+        for (int i = 0; i < length; i++) {
+            text[position++] = FIRST_LETTER_CODE + word[i] - 'a';
+        }
+        text[position++] = SEPARATOR_CODE;
+    }
+    index->wordStarts[index->wordCount] = position;
+    text[position] = END_CODE;
+    index->textSize = size;
+
+    return text;
+}
+
+/**
+ * Sorts the suffixes of the text by prefix doubling with radix sorts.
+ *
+ * Separators are ranked by their position instead of what follows them.
+ * No match ever crosses a separator, and this stops the doubling once the
+ * longest word is covered rather than the longest repeated run of words.
+ *
+ * Parameters:
+ *  text - the codes to sort the suffixes of
+ *  size - the number of codes
+ *
+ * Returns the suffix array
+ * */
+static int *build_suffix_array(uint8_t *text, int size) {
+    int *suffixArray = (int*) malloc(size * sizeof(int));
+    int *rank = (int*) malloc(size * sizeof(int));
+    int *other = (int*) malloc(size * sizeof(int));
+
+    int separators = 0;
+    for (int i = 0; i < size; i++) {
+        separators += text[i] == SEPARATOR_CODE;
+    }
+    int nextSeparator = 1;
+    for (int i = 0; i < size; i++) {
+        if (text[i] == SEPARATOR_CODE) {
+            rank[i] = nextSeparator++;
+        } else if (text[i] == END_CODE) {
+            rank[i] = 0;
+        } else {
+            rank[i] = separators + text[i];
+        }
+    }
+    int classes = separators + FM_ALPHABET_SIZE;
+    int *counts = (int*) calloc((classes > size ? classes : size) + 1,
+            sizeof(int));
+
+    /* Sort by the first code alone */
+    for (int i = 0; i < size; i++) {
+        counts[rank[i] + 1]++;
+    }
+    for (int i = 0; i < classes; i++) {
+        counts[i + 1] += counts[i];
+    }
+    for (int i = 0; i < size; i++) {
+        suffixArray[counts[rank[i]]++] = i;
+    }
+
+    for (int step = 1; ; step *= 2) {
+        /* Order by the second half: suffixes too short to have one come
+         * first, the rest follow the order of their second half */
+        int sorted = 0;
+        for (int i = size - step; i < size; i++) {
+            other[sorted++] = i;
+        }
+        for (int i = 0; i < size; i++) {
+            if (suffixArray[i] >= step) {
+                other[sorted++] = suffixArray[i] - step;
+            }
+        }
+
+        /* Then a stable sort by the first half */
+        memset(counts, 0, (classes + 1) * sizeof(int));
+        for (int i = 0; i < size; i++) {
+            counts[rank[i] + 1]++;
+        }
+        for (int i = 0; i < classes; i++) {
+            counts[i + 1] += counts[i];
+        }
+        for (int i = 0; i < size; i++) {
+            suffixArray[counts[rank[other[i]]]++] = other[i];
+        }
+
+        other[suffixArray[0]] = 0;
+        for (int i = 1; i < size; i++) {
+            int current = suffixArray[i];
+            int previous = suffixArray[i - 1];
+            int currentSecond = current + step < size ?
+                    rank[current + step] : -1;
+            int previousSecond = previous + step < size ?
+                    rank[previous + step] : -1;
+            other[current] = other[previous] + (rank[current] !=
+                    rank[previous] || currentSecond != previousSecond);
+        }
+        int *swap = rank;
+        rank = other;
+        other = swap;
+        classes = rank[suffixArray[size - 1]] + 1;
+
+        if (classes == size) {
+            break;
+        }
+    }
+
+    free(counts);
+    free(rank);
+    free(other);
+    return suffixArray;
+}
+
+FmIndex *fm_index_build(DictionaryWords *dict) {
+    FmIndex *index = (FmIndex*) malloc(sizeof(FmIndex));
+    uint8_t *text = build_text(index, dict);
+    if (text == NULL) {
+        free(index);
+        return NULL;
+    }
+    int size = index->textSize;
+    index->suffixArray = build_suffix_array(text, size);
+
+    index->bwt = (uint8_t*) malloc(size);
+    for (int i = 0; i < size; i++) {
+        int position = index->suffixArray[i];
+        index->bwt[i] = text[position ? position - 1 : size - 1];
+    }
+
+    memset(index->counts, 0, sizeof(index->counts));
+    for (int i = 0; i < size; i++) {
+        index->counts[text[i] + 1]++;
+    }
+    for (int code = 0; code < FM_ALPHABET_SIZE; code++) {
+        index->counts[code + 1] += index->counts[code];
+    }
+    free(text);
+
+    int samples = size / FM_SAMPLE_RATE + 1;
+    index->occurrences = (int*) malloc((size_t) samples * FM_ALPHABET_SIZE *
+            sizeof(int));
+    int running[FM_ALPHABET_SIZE] = {0};
+    for (int i = 0; i < size; i++) {
+        if (i % FM_SAMPLE_RATE == 0) {
+            memcpy(index->occurrences + (size_t) (i / FM_SAMPLE_RATE) *
+                    FM_ALPHABET_SIZE, running, sizeof(running));
+        }
+        running[index->bwt[i]]++;
+    }
+    if (size % FM_SAMPLE_RATE == 0) {
+        memcpy(index->occurrences + (size_t) (size / FM_SAMPLE_RATE) *
+                FM_ALPHABET_SIZE, running, sizeof(running));
+    }
+
+    return index;
+}
+
+/**
+ * Counts how often a code appears in the transform before a position
+ *
+ * Parameters:
+ *  index - the FM-index
+ *  code - the code to count
+ *  position - where to stop counting
+ *
+ * Returns the count
+ * */
+static int occurrences_before(FmIndex *index, int code, int position) {
+    int sample = position / FM_SAMPLE_RATE;
+    int count = index->occurrences[(size_t) sample * FM_ALPHABET_SIZE + code];
+    for (int i = sample * FM_SAMPLE_RATE; i < position; i++) {
+        count += index->bwt[i] == code;
+    }
+    return count;
+}
+
+/**
+ * Finds the word a text position falls in
+ *
+ * Parameters:
+ *  index - the FM-index
+ *  position - the position in the text
+ *
+ * Returns the word number, the index into wordStarts
+ * */
+static int word_at(FmIndex *index, int position) {
+    int low = 0;
+    int high = index->wordCount - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (index->wordStarts[middle] <= position) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+/**
+ * Records the words holding each match of the core in a suffix array
+ * range, if the word has room for the leading and trailing '?'.
+ *
+ * Parameters:
+ *  search - the search being run
+ *  start - the first suffix array entry of the range
+ *  end - one past the last entry
+ *
+ * Returns nothing
+ * */
+static void report_range(BackwardSearch *search, int start, int end) {
+    FmIndex *index = search->index;
+    for (int i = start; i < end; i++) {
+        int position = index->suffixArray[i];
+        int word = word_at(index, position);
+        int wordEnd = index->wordStarts[word + 1] - 1; // the separator
+        if (position - search->leading >= index->wordStarts[word] &&
+                position + search->coreLength + search->trailing <=
+                wordEnd) {
+            dict_words_add_id(search->matches, word);
+        }
+    }
+}
+
+/**
+ * Extends a match one code to the left, trying every letter for '?'
+ *
+ * Parameters:
+ *  search - the search being run
+ *  position - the position in the core to match next, going backwards
+ *  start - the first suffix array entry matching the core after position
+ *  end - one past the last such entry
+ *
+ * Returns nothing
+ * */
+static void backward_search(BackwardSearch *search, int position,
+        int start, int end) {
+    if (start >= end) {
+        return;
+    }
+    if (position < 0) {
+        report_range(search, start, end);
+        return;
+    }
+
+    FmIndex *index = search->index;
+    int firstCode = FIRST_LETTER_CODE;
+    int lastCode = FM_ALPHABET_SIZE - 1;
+    if (search->core[position] != '?') {
+        firstCode = lastCode = FIRST_LETTER_CODE +
+                tolower(search->core[position]) - 'a';
+    }
+    for (int code = firstCode; code <= lastCode; code++) {
+        backward_search(search, position - 1,
+                index->counts[code] + occurrences_before(index, code, start),
+                index->counts[code] + occurrences_before(index, code, end));
+    }
+}
+
+DictionaryWords *fm_index_match(FmIndex *index, DictionaryWords *dict,
+        char *pattern) {
+    BackwardSearch search;
+    int patternLength = strlen(pattern);
+    search.index = index;
+    search.leading = 0;
+    while (pattern[search.leading] == '?') {
+        search.leading++;
+    }
+    search.trailing = 0;
+    while (search.trailing < patternLength - search.leading &&
+            pattern[patternLength - 1 - search.trailing] == '?') {
+        search.trailing++;
+    }
+    search.core = pattern + search.leading;
+    search.coreLength = patternLength - search.leading - search.trailing;
+    search.matches = dict_words_init_matches(dict);
+
+    if (search.coreLength == 0) {
+        /* Only the length of the word matters */
+        for (int word = 0; word < index->wordCount; word++) {
+            if (index->wordStarts[word + 1] - 1 - index->wordStarts[word] >=
+                    patternLength) {
+                dict_words_add_id(search.matches, word);
+            }
+        }
+    } else {
+        backward_search(&search, search.coreLength - 1, 0, index->textSize);
+        if (search.matches->size > 1) {
+            qsort(search.matches->ids, search.matches->size, sizeof(int),
+                    compare_ids);
+        }
+    }
+
+    /* Drop repeated words and turn word numbers into dictionary ids */
+    int unique = 0;
+    for (int i = 0; i < search.matches->size; i++) {
+        if (i == 0 || search.matches->ids[i] != search.matches->ids[i - 1]) {
+            search.matches->ids[unique++] = search.matches->ids[i];
+        }
+    }
+    search.matches->size = unique;
+    for (int i = 0; i < unique; i++) {
+        search.matches->ids[i] = index->wordIds[search.matches->ids[i]];
+    }
+
+    return search.matches;
+}
+
+void fm_index_free(FmIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+    free(index->bwt);
+    free(index->suffixArray);
+    free(index->occurrences);
+    free(index->wordStarts);
+    free(index->wordIds);
+    free(index);
+}
@@ -0,0 +1,76 @@
+#ifndef FMINDEX_H_
+#define FMINDEX_H_
+
+#include <stdint.h>
+#include <limits.h>
+
+#include "common.h"
+
+/* The number of distinct codes in the indexed text: the end marker,
+ * the word separator and the 26 letters */
+#define FM_ALPHABET_SIZE 28
+
+/* How often the running code counts of the transform are stored */
+#define FM_SAMPLE_RATE 64
+
+/* The longest text indexed. Text positions are ints, and the suffix
+ * sort looks up to one text length past a position. */
+#define FM_MAX_TEXT_SIZE (INT_MAX / 2)
+
+/* An FM-index over the case-folded alphabetic words joined into one text,
+ * each word followed by a separator.
+ *
+ * bwt is the Burrows-Wheeler transform of the text and suffixArray the
+ * full suffix array, used to turn matches back into text positions.
+ * occurrences holds, for every FM_SAMPLE_RATE positions of bwt, how many
+ * times each code appeared before it. Word k of the text starts at
+ * wordStarts[k] and is the dictionary word wordIds[k]. */
+struct FmIndex {
+    int textSize;
+    uint8_t *bwt;
+    int *suffixArray;
+    int counts[FM_ALPHABET_SIZE + 1];
+    int *occurrences;
+    int wordCount;
+    int *wordStarts;
+    int *wordIds;
+};
+
+/**
+ * Builds the FM-index over all the alphabetic words in a dictionary,
+ * which must already be normalized
+ *
+ * Parameters:
+ *  dict - the dictionary to index
+ *
+ * Returns the index, free it with fm_index_free(), or NULL if the words
+ * would make a text longer than FM_MAX_TEXT_SIZE
+ * */
+FmIndex *fm_index_build(DictionaryWords *dict);
+
+/**
+ * Finds the words that contain the pattern anywhere by backward search.
+ * Each '?' in the middle of the pattern tries every letter, leading and
+ * trailing '?' only need room in the word around the rest of the match.
+ *
+ * Parameters:
+ *  index - the FM-index of the dictionary
+ *  dict - the dictionary the index was built over
+ *  pattern - the pattern of letters and '?' to look for
+ *
+ * Returns the match set in dictionary order
+ * */
+DictionaryWords *fm_index_match(FmIndex *index, DictionaryWords *dict,
+        char *pattern);
+
+/**
+ * Frees all the memory held by the index
+ *
+ * Parameters:
+ *  index - the index to free
+ *
+ * Returns nothing
+ * */
+void fm_index_free(FmIndex *index);
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "frontcode.h"
+#include "matcher.h"
+
+/* The most bytes a varint of a 32 bit length takes */
+#define MAX_VARINT_SIZE 5
+
+/**
+ * Appends a number to the encoded words, seven bits a byte with the top
+ * bit set on all but the last byte. There must be room for it.
+ *
+ * Parameters:
+ *  coded - the words being encoded
+ *  value - the number to append
+ *
+ * Returns nothing
+ * */
+static void write_varint(FrontCoded *coded, uint32_t value) {
+    while (value >= 0x80) {
+        coded->data[coded->dataSize++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    coded->data[coded->dataSize++] = value;
+}
+
+/**
+ * Reads a number written by write_varint().
+ *
+ * Parameters:
+ *  next - where the number starts, moved past it
+ *
+ * Returns the number
+ * */
+static uint32_t read_varint(const unsigned char **next) {
+    uint32_t value = 0;
+    int shift = 0;
+    while (**next & 0x80) {
+        value |= (uint32_t) (*(*next)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return value | (uint32_t) *(*next)++ << shift;
+}
+
+FrontCoded *front_coded_build(DictionaryWords *dict) {
+    FrontCoded *coded = (FrontCoded*) malloc(sizeof(FrontCoded));
+    coded->size = dict->size;
+    coded->maxWordLength = 0;
+    coded->blockCount = (dict->size + FRONT_CODE_BLOCK_SIZE - 1) /
+            FRONT_CODE_BLOCK_SIZE;
+    coded->restarts = (size_t*) malloc((coded->blockCount + 1) *
+            sizeof(size_t));
+    coded->dataSize = 0;
+    size_t memsize = dict->arenaSize / 2 + 1;
+    coded->data = (unsigned char*) malloc(memsize);
+
+    const char *previous = "";
+    int previousLength = 0;
+    for (int id = 0; id < dict->size; id++) {
+        const char *word = dict->arena + dict->offsets[id];
+        int length = dict->wordInfo[id] & WORD_LENGTH_MASK;
+        int shared = 0;
+        if (id % FRONT_CODE_BLOCK_SIZE == 0) {
+            coded->restarts[id / FRONT_CODE_BLOCK_SIZE] = coded->dataSize;
+        } else {
+            while (shared < length && shared < previousLength &&
+                    word[shared] == previous[shared]) {
+                shared++;
+            }
+        }
+
+        while (coded->dataSize + 2 * MAX_VARINT_SIZE + length - shared >
+                memsize) {
+            memsize *= 2;
+            coded->data = (unsigned char*) realloc(coded->data, memsize);
+        }
+        write_varint(coded, shared);
+        write_varint(coded, length - shared);
+        memcpy(coded->data + coded->dataSize, word + shared, length - shared);
+        coded->dataSize += length - shared;
+
+        if (length > coded->maxWordLength) {
+            coded->maxWordLength = length;
+        }
+        previous = word;
+        previousLength = length;
+    }
+
+    coded->data = (unsigned char*) realloc(coded->data, coded->dataSize + 1);
+    return coded;
+}
+
+void front_coded_free(FrontCoded *coded) {
+    if (coded == NULL) {
+        return;
+    }
+    free(coded->data);
+    free(coded->restarts);
+    free(coded);
+}
+
+void front_coded_cursor_init(FrontCodedCursor *cursor,
+        const FrontCoded *coded, int firstId) {
+    /* Room for a block compare from the start of the longest word */
+    cursor->readableBytes = coded->maxWordLength + MATCH_BLOCK_SIZE;
+    cursor->word = (char*) calloc(cursor->readableBytes + 1, 1);
+    cursor->folded = (char*) calloc(cursor->readableBytes + 1, 1);
+    cursor->coded = coded;
+    cursor->length = 0;
+    cursor->alphaLength = 0;
+
+    int block = firstId / FRONT_CODE_BLOCK_SIZE;
+    cursor->id = block * FRONT_CODE_BLOCK_SIZE - 1;
+    cursor->next = coded->data + (block < coded->blockCount ?
+            coded->restarts[block] : coded->dataSize);
+    while (cursor->id + 1 < firstId && front_coded_next(cursor)) {
+    }
+}
+
+bool front_coded_next(FrontCodedCursor *cursor) {
+    if (cursor->id + 1 >= cursor->coded->size) {
+        return false;
+    }
+    cursor->id++;
+
+    int shared = read_varint(&cursor->next);
+    int suffixLength = read_varint(&cursor->next);
+    int length = shared + suffixLength;
+    memcpy(cursor->word + shared, cursor->next, suffixLength);
+    cursor->next += suffixLength;
+
+    /* Only 'A' to 'Z' get the case bit, as dict_words_normalize() does */
+    const unsigned char *word = (unsigned char*) cursor->word;
+    unsigned char *folded = (unsigned char*) cursor->folded;
+    for (int i = shared; i < length; i++) {
+        folded[i] = word[i] | ((unsigned char) (word[i] - 'A') < 26) << 5;
+    }
+    cursor->word[length] = 0;
+    cursor->folded[length] = 0;
+
+    /* The shared bytes keep what was known of the letters in them */
+    if (cursor->alphaLength >= shared) {
+        cursor->alphaLength = shared;
+        while (cursor->alphaLength < length &&
+                (unsigned char) (folded[cursor->alphaLength] - 'a') < 26) {
+            cursor->alphaLength++;
+        }
+    }
+    cursor->length = length;
+    return true;
+}
+
+void front_coded_cursor_free(FrontCodedCursor *cursor) {
+    free(cursor->word);
+    free(cursor->folded);
+}
@@ -0,0 +1,104 @@
+#ifndef FRONTCODE_H_
+#define FRONTCODE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+/* How many words share a restart point, the first of them stored whole */
+#define FRONT_CODE_BLOCK_SIZE 16
+
+/* A dictionary's words front coded in blocks.
+ *
+ * Each word is stored as the number of bytes it shares with the word
+ * before it and the bytes that follow, both lengths as varints. The first
+ * word of every block of FRONT_CODE_BLOCK_SIZE shares nothing, so decoding
+ * can start at any block: restarts[b] is where block b starts in data.
+ * Sorted word lists share long prefixes and shrink the most. */
+typedef struct FrontCoded FrontCoded;
+struct FrontCoded {
+    unsigned char *data;
+    size_t dataSize;
+    size_t *restarts;
+    int blockCount;
+    int size;
+    int maxWordLength;
+};
+
+/* Decodes the words of a FrontCoded one after another.
+ *
+ * word is the current word as stored and folded its lower case copy,
+ * both null terminated and followed by enough padding that
+ * readableBytes can be read from their start. alphaLength counts the
+ * letters at the start of the word, so the word is all letters when it
+ * equals length. */
+typedef struct {
+    const FrontCoded *coded;
+    const unsigned char *next;
+    int id;
+    int length;
+    int alphaLength;
+    char *word;
+    char *folded;
+    size_t readableBytes;
+} FrontCodedCursor;
+
+/**
+ * Front codes the words of a dictionary in dictionary order. The
+ * dictionary is not needed afterwards.
+ *
+ * Parameters:
+ *  dict - the dictionary to encode
+ *
+ * Returns the encoded words, free with front_coded_free()
+ * */
+FrontCoded *front_coded_build(DictionaryWords *dict);
+
+/**
+ * Frees front coded words.
+ *
+ * Parameters:
+ *  coded - the words to free, may be NULL
+ *
+ * Returns nothing
+ * */
+void front_coded_free(FrontCoded *coded);
+
+/**
+ * Gets a cursor ready to decode from any word on. Decoding starts at the
+ * restart point of the word's block, so at most FRONT_CODE_BLOCK_SIZE - 1
+ * words are decoded to reach it.
+ *
+ * Parameters:
+ *  cursor - the cursor to set up
+ *  coded - the words to decode
+ *  firstId - the id of the word the first front_coded_next() gives
+ *
+ * Returns nothing
+ * */
+void front_coded_cursor_init(FrontCodedCursor *cursor,
+        const FrontCoded *coded, int firstId);
+
+/**
+ * Moves a cursor on to the next word. Only the bytes the word doesn't
+ * share with the one before are copied and folded.
+ *
+ * Parameters:
+ *  cursor - the cursor
+ *
+ * Returns false once there are no words left
+ * */
+bool front_coded_next(FrontCodedCursor *cursor);
+
+/**
+ * Frees the buffers of a cursor.
+ *
+ * Parameters:
+ *  cursor - the cursor
+ *
+ * Returns nothing
+ * */
+void front_coded_cursor_free(FrontCodedCursor *cursor);
+
+#endif
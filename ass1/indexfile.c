@@ -0,0 +1,827 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "indexfile.h"
+#include "utils.h"
+#include "letterindex.h"
+#include "dawg.h"
+#include "fmindex.h"
+
+/* Every section starts on a boundary of this many bytes */
+#define SECTION_ALIGNMENT 64
+
+/* Flags for the optional arrays an index file carries */
+#define HAS_LETTER_INDEX 0x1
+#define HAS_DAWG 0x2
+#define HAS_FM_INDEX 0x4
+#define HAS_SORT_RANKS 0x8
+
+/* The arrays stored in an index file, in file order */
+typedef enum {
+    SECTION_ARENA, SECTION_FOLDED, SECTION_OFFSETS, SECTION_WORD_INFO,
+    SECTION_LETTER_SIGS,
+    SECTION_LENGTH_STARTS, SECTION_LENGTH_IDS, SECTION_SORT_RANKS,
+    SECTION_SORTED_IDS,
+    SECTION_LETTER_GROUP_OFFSETS, SECTION_LETTER_GROUP_BLOCKS,
+    SECTION_LETTER_BITS,
+    SECTION_DAWG_NODE_FIRST_EDGE, SECTION_DAWG_NODE_WORDS,
+    SECTION_DAWG_NODE_FINAL, SECTION_DAWG_EDGE_LETTERS,
+    SECTION_DAWG_EDGE_TARGETS, SECTION_DAWG_RANK_STARTS,
+    SECTION_DAWG_RANK_IDS,
+    SECTION_FM_BWT, SECTION_FM_SUFFIX_ARRAY, SECTION_FM_OCCURRENCES,
+    SECTION_FM_WORD_STARTS, SECTION_FM_WORD_IDS,
+    SECTION_COUNT
+} SectionId;
+
+/* Where an array is in the file */
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} IndexSection;
+
+/* The start of every index file: what it was built from, the sizes the
+ * arrays can't tell by themselves and the table of sections */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t sourceDevice;
+    uint64_t sourceInode;
+    int64_t sourceSize;
+    int64_t sourceMtime;
+    int64_t sourceMtimeNsec;
+    char sourceFilename[PATH_MAX];
+    uint64_t arenaSize;
+    int32_t wordCount;
+    int32_t maxWordLength;
+    uint64_t letterBitsSize;
+    int32_t dawgRoot;
+    int32_t dawgNodeCount;
+    int32_t dawgEdgeCount;
+    int32_t dawgRankCount;
+    int32_t fmTextSize;
+    int32_t fmWordCount;
+    int32_t fmCounts[FM_ALPHABET_SIZE + 1];
+    IndexSection sections[SECTION_COUNT];
+} IndexHeader;
+
+bool is_index_file(char *filename) {
+    char magic[sizeof(INDEX_MAGIC)];
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    /* Reading a pipe would take words the loader then never sees */
+    struct stat info;
+    bool isIndex = fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+            pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+            !memcmp(magic, INDEX_MAGIC, sizeof(magic));
+    close(fd);
+    return isIndex;
+}
+
+/**
+ * Records an array to be written as a section.
+ *
+ * Parameters:
+ *  header - the header holding the section table
+ *  data - where each section's bytes are, indexed by section
+ *  id - the section
+ *  array - the bytes of the section
+ *  size - the number of bytes
+ *
+ * Returns nothing
+ * */
+static void add_section(IndexHeader *header, const void **data,
+        SectionId id, const void *array, size_t size) {
+    data[id] = array;
+    header->sections[id].size = size;
+}
+
+/**
+ * Fills in the section table of a dictionary's header.
+ *
+ * Parameters:
+ *  header - the header to fill in
+ *  data - set to where each section's bytes are, indexed by section
+ *  dict - the dictionary being written
+ *
+ * Returns nothing
+ * */
+static void describe_sections(IndexHeader *header, const void **data,
+        DictionaryWords *dict) {
+    header->arenaSize = dict->arenaSize;
+    header->wordCount = dict->size;
+    header->maxWordLength = dict->maxWordLength;
+    add_section(header, data, SECTION_ARENA, dict->arena, dict->arenaSize);
+    add_section(header, data, SECTION_FOLDED, dict->folded, dict->arenaSize);
+    add_section(header, data, SECTION_OFFSETS, dict->offsets,
+            dict->size * sizeof(size_t));
+    add_section(header, data, SECTION_WORD_INFO, dict->wordInfo,
+            dict->size * sizeof(uint32_t));
+    add_section(header, data, SECTION_LETTER_SIGS, dict->letterSigs,
+            dict->size * sizeof(uint32_t));
+    add_section(header, data, SECTION_LENGTH_STARTS, dict->lengthStarts,
+            (dict->maxWordLength + 2) * sizeof(int));
+    add_section(header, data, SECTION_LENGTH_IDS, dict->lengthIds,
+            dict->size * sizeof(int));
+    if (dict->sortedIds != NULL) {
+        header->flags |= HAS_SORT_RANKS;
+        add_section(header, data, SECTION_SORT_RANKS, dict->sortRanks,
+                dict->size * sizeof(int));
+        add_section(header, data, SECTION_SORTED_IDS, dict->sortedIds,
+                dict->size * sizeof(int));
+    }
+
+    LetterIndex *letters = dict->letterIndex;
+    if (letters != NULL) {
+        header->flags |= HAS_LETTER_INDEX;
+        header->letterBitsSize = letters->bitsSize;
+        add_section(header, data, SECTION_LETTER_GROUP_OFFSETS,
+                letters->groupOffsets,
+                (letters->maxWordLength + 1) * sizeof(size_t));
+        add_section(header, data, SECTION_LETTER_GROUP_BLOCKS,
+                letters->groupBlocks,
+                (letters->maxWordLength + 1) * sizeof(int));
+        add_section(header, data, SECTION_LETTER_BITS, letters->bits,
+                letters->bitsSize * sizeof(uint64_t));
+    }
+
+    Dawg *dawg = dict->dawg;
+    if (dawg != NULL) {
+        header->flags |= HAS_DAWG;
+        header->dawgRoot = dawg->root;
+        header->dawgNodeCount = dawg->nodeCount;
+        header->dawgEdgeCount = dawg->edgeCount;
+        header->dawgRankCount = dawg->rankCount;
+        add_section(header, data, SECTION_DAWG_NODE_FIRST_EDGE,
+                dawg->nodeFirstEdge, (dawg->nodeCount + 1) * sizeof(int));
+        add_section(header, data, SECTION_DAWG_NODE_WORDS, dawg->nodeWords,
+                dawg->nodeCount * sizeof(int));
+        add_section(header, data, SECTION_DAWG_NODE_FINAL, dawg->nodeFinal,
+                dawg->nodeCount * sizeof(bool));
+        add_section(header, data, SECTION_DAWG_EDGE_LETTERS,
+                dawg->edgeLetters, dawg->edgeCount);
+        add_section(header, data, SECTION_DAWG_EDGE_TARGETS,
+                dawg->edgeTargets, dawg->edgeCount * sizeof(int));
+        add_section(header, data, SECTION_DAWG_RANK_STARTS, dawg->rankStarts,
+                (dawg->rankCount + 1) * sizeof(int));
+        add_section(header, data, SECTION_DAWG_RANK_IDS, dawg->rankIds,
+                dawg->rankStarts[dawg->rankCount] * sizeof(int));
+    }
+
+    FmIndex *fm = dict->fmIndex;
+    if (fm != NULL) {
+        header->flags |= HAS_FM_INDEX;
+        header->fmTextSize = fm->textSize;
+        header->fmWordCount = fm->wordCount;
+        memcpy(header->fmCounts, fm->counts, sizeof(fm->counts));
+        add_section(header, data, SECTION_FM_BWT, fm->bwt, fm->textSize);
+        add_section(header, data, SECTION_FM_SUFFIX_ARRAY, fm->suffixArray,
+                (size_t) fm->textSize * sizeof(int));
+        add_section(header, data, SECTION_FM_OCCURRENCES, fm->occurrences,
+                ((size_t) fm->textSize / FM_SAMPLE_RATE + 1) *
+                FM_ALPHABET_SIZE * sizeof(int));
+        add_section(header, data, SECTION_FM_WORD_STARTS, fm->wordStarts,
+                (fm->wordCount + 1) * sizeof(int));
+        add_section(header, data, SECTION_FM_WORD_IDS, fm->wordIds,
+                fm->wordCount * sizeof(int));
+    }
+
+    uint64_t offset = sizeof(IndexHeader);
+    for (int id = 0; id < SECTION_COUNT; id++) {
+        offset = (offset + SECTION_ALIGNMENT - 1) /
+                SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+        header->sections[id].offset = offset;
+        offset += header->sections[id].size;
+    }
+}
+
+bool index_file_write(DictionaryWords *dict, char *sourceFilename,
+        char *indexFilename) {
+    IndexHeader *header = (IndexHeader*) calloc(1, sizeof(IndexHeader));
+    const void *data[SECTION_COUNT] = {NULL};
+    struct stat info;
+
+    if (stat(sourceFilename, &info) == -1 ||
+            realpath(sourceFilename, header->sourceFilename) == NULL) {
+        free(header);
+        return false;
+    }
+    memcpy(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header->version = INDEX_VERSION;
+    header->sourceDevice = info.st_dev;
+    header->sourceInode = info.st_ino;
+    header->sourceSize = info.st_size;
+    header->sourceMtime = info.st_mtim.tv_sec;
+    header->sourceMtimeNsec = info.st_mtim.tv_nsec;
+    describe_sections(header, data, dict);
+
+    /* Written beside the target so the rename stays on one filesystem */
+    size_t nameLength = strlen(indexFilename) + 32;
+    char *temporaryFilename = (char*) malloc(nameLength);
+    snprintf(temporaryFilename, nameLength, "%s.tmp.%d", indexFilename,
+            (int) getpid());
+
+    bool isWritten = false;
+    FILE *file = fopen(temporaryFilename, "w");
+    if (file != NULL) {
+        static const char padding[SECTION_ALIGNMENT] = {0};
+        uint64_t position = sizeof(IndexHeader);
+        isWritten = fwrite(header, sizeof(IndexHeader), 1, file) == 1;
+        for (int id = 0; id < SECTION_COUNT && isWritten; id++) {
+            IndexSection *section = &header->sections[id];
+            isWritten = fwrite(padding, 1, section->offset - position,
+                    file) == section->offset - position &&
+                    (section->size == 0 || fwrite(data[id], 1,
+                    section->size, file) == section->size);
+            position = section->offset + section->size;
+        }
+        isWritten = fclose(file) == 0 && isWritten &&
+                rename(temporaryFilename, indexFilename) == 0;
+        if (!isWritten) {
+            unlink(temporaryFilename);
+        }
+    }
+
+    free(temporaryFilename);
+    free(header);
+    return isWritten;
+}
+
+/**
+ * Checks that the word list an index was built from still has the
+ * identity, size and modification time it had then.
+ *
+ * Parameters:
+ *  header - the header of the index
+ *
+ * Returns true if the index describes the word list as it is now
+ * */
+static bool is_source_unchanged(IndexHeader *header) {
+    struct stat info;
+    if (stat(header->sourceFilename, &info) == -1) {
+        return false;
+    }
+    return header->sourceDevice == (uint64_t) info.st_dev &&
+            header->sourceInode == (uint64_t) info.st_ino &&
+            header->sourceSize == (int64_t) info.st_size &&
+            header->sourceMtime == (int64_t) info.st_mtim.tv_sec &&
+            header->sourceMtimeNsec == (int64_t) info.st_mtim.tv_nsec;
+}
+
+/**
+ * Checks that a section holds exactly as many elements as the header
+ * says.
+ *
+ * Parameters:
+ *  header - the header of the file
+ *  id - the section to check
+ *  count - how many elements the header says the section holds
+ *  elementSize - the size of one element
+ *
+ * Returns true if the section is that size
+ * */
+static bool is_section_size(IndexHeader *header, SectionId id,
+        int64_t count, size_t elementSize) {
+    uint64_t size = header->sections[id].size;
+    return count >= 0 && size % elementSize == 0 &&
+            size / elementSize == (uint64_t) count;
+}
+
+/**
+ * Checks the counts in the header against the sizes of the sections they
+ * describe, so a truncated or corrupt index is never read past the end of
+ * a section. The sections must already be known to lie in the file.
+ *
+ * Parameters:
+ *  mapping - the start of the mapped file
+ *  header - the header of the file
+ *
+ * Returns true if the counts and sections agree
+ * */
+static bool are_counts_consistent(char *mapping, IndexHeader *header) {
+    for (int id = 0; id < SECTION_COUNT; id++) {
+        if (header->sections[id].offset % SECTION_ALIGNMENT) {
+            return false;
+        }
+    }
+
+    int words = header->wordCount;
+    int maxLength = header->maxWordLength;
+    if (header->arenaSize > INT64_MAX || maxLength < 0 ||
+            maxLength > WORD_LENGTH_MASK ||
+            !is_section_size(header, SECTION_ARENA, header->arenaSize, 1) ||
+            !is_section_size(header, SECTION_FOLDED, header->arenaSize, 1) ||
+            !is_section_size(header, SECTION_OFFSETS, words, sizeof(size_t)) ||
+            !is_section_size(header, SECTION_WORD_INFO, words,
+            sizeof(uint32_t)) ||
+            !is_section_size(header, SECTION_LETTER_SIGS, words,
+            sizeof(uint32_t)) ||
+            !is_section_size(header, SECTION_LENGTH_STARTS, maxLength + 2,
+            sizeof(int)) ||
+            !is_section_size(header, SECTION_LENGTH_IDS, words, sizeof(int))) {
+        return false;
+    }
+
+    if ((header->flags & HAS_SORT_RANKS) && (!is_section_size(header,
+            SECTION_SORT_RANKS, words, sizeof(int)) || !is_section_size(
+            header, SECTION_SORTED_IDS, words, sizeof(int)))) {
+        return false;
+    }
+
+    if ((header->flags & HAS_LETTER_INDEX) && (header->letterBitsSize >
+            INT64_MAX || !is_section_size(header,
+            SECTION_LETTER_GROUP_OFFSETS, maxLength + 1, sizeof(size_t)) ||
+            !is_section_size(header, SECTION_LETTER_GROUP_BLOCKS,
+            maxLength + 1, sizeof(int)) || !is_section_size(header,
+            SECTION_LETTER_BITS, header->letterBitsSize,
+            sizeof(uint64_t)))) {
+        return false;
+    }
+
+    if (header->flags & HAS_DAWG) {
+        int nodes = header->dawgNodeCount;
+        int edges = header->dawgEdgeCount;
+        int ranks = header->dawgRankCount;
+        if (header->dawgRoot < 0 || header->dawgRoot >= nodes ||
+                !is_section_size(header, SECTION_DAWG_NODE_FIRST_EDGE,
+                (int64_t) nodes + 1, sizeof(int)) ||
+                !is_section_size(header, SECTION_DAWG_NODE_WORDS, nodes,
+                sizeof(int)) ||
+                !is_section_size(header, SECTION_DAWG_NODE_FINAL, nodes,
+                sizeof(bool)) ||
+                !is_section_size(header, SECTION_DAWG_EDGE_LETTERS, edges,
+                1) ||
+                !is_section_size(header, SECTION_DAWG_EDGE_TARGETS, edges,
+                sizeof(int)) ||
+                !is_section_size(header, SECTION_DAWG_RANK_STARTS,
+                (int64_t) ranks + 1, sizeof(int))) {
+            return false;
+        }
+        int *rankStarts = (int*) (mapping +
+                header->sections[SECTION_DAWG_RANK_STARTS].offset);
+        if (!is_section_size(header, SECTION_DAWG_RANK_IDS,
+                rankStarts[ranks], sizeof(int))) {
+            return false;
+        }
+    }
+
+    if (header->flags & HAS_FM_INDEX) {
+        int64_t textSize = header->fmTextSize;
+        if (!is_section_size(header, SECTION_FM_BWT, textSize, 1) ||
+                !is_section_size(header, SECTION_FM_SUFFIX_ARRAY, textSize,
+                sizeof(int)) ||
+                !is_section_size(header, SECTION_FM_OCCURRENCES,
+                (textSize / FM_SAMPLE_RATE + 1) * FM_ALPHABET_SIZE,
+                sizeof(int)) ||
+                !is_section_size(header, SECTION_FM_WORD_STARTS,
+                (int64_t) header->fmWordCount + 1, sizeof(int)) ||
+                !is_section_size(header, SECTION_FM_WORD_IDS,
+                header->fmWordCount, sizeof(int))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Finds a section in a mapped index file.
+ *
+ * Parameters:
+ *  mapping - the start of the mapped file
+ *  header - the header of the file
+ *  id - the section to find
+ *
+ * Returns a pointer to the first byte of the section
+ * */
+static void *section_data(char *mapping, IndexHeader *header, SectionId id) {
+    return mapping + header->sections[id].offset;
+}
+
+/**
+ * Checks that a run of starts begins at 0, never decreases and ends at
+ * the expected value, so every range taken from it is in bounds.
+ *
+ * Parameters:
+ *  starts - the starts, count + 1 of them
+ *  count - the number of ranges
+ *  end - what the last start must be
+ *
+ * Returns true if the starts are in order
+ * */
+static bool are_starts_in_order(const int *starts, int64_t count,
+        int64_t end) {
+    if (starts[0] != 0 || starts[count] != end) {
+        return false;
+    }
+    for (int64_t i = 0; i < count; i++) {
+        if (starts[i + 1] < starts[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks that every id in an array is a valid index below a limit.
+ *
+ * Parameters:
+ *  ids - the ids
+ *  count - the number of ids
+ *  limit - one past the largest valid id
+ *
+ * Returns true if all the ids are in range
+ * */
+static bool are_ids_below(const int *ids, int64_t count, int64_t limit) {
+    for (int64_t i = 0; i < count; i++) {
+        if (ids[i] < 0 || ids[i] >= limit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks that every word lies in the arena with its folded copy null
+ * terminated and only marked as all letters if it is, and that the length
+ * groups and sort order only hold ids of
+ * words.
+ *
+ * Parameters:
+ *  mapping - the start of the mapped file
+ *  header - the header of the file
+ *
+ * Returns true if the words are consistent
+ * */
+static bool are_words_consistent(char *mapping, IndexHeader *header) {
+    int words = header->wordCount;
+    uint64_t arenaSize = header->arenaSize;
+    size_t *offsets = section_data(mapping, header, SECTION_OFFSETS);
+    uint32_t *wordInfo = section_data(mapping, header, SECTION_WORD_INFO);
+    char *folded = section_data(mapping, header, SECTION_FOLDED);
+    for (int id = 0; id < words; id++) {
+        uint32_t length = wordInfo[id] & WORD_LENGTH_MASK;
+        if (length > (uint32_t) header->maxWordLength ||
+                offsets[id] >= arenaSize ||
+                length >= arenaSize - offsets[id] ||
+                folded[offsets[id] + length] != 0) {
+            return false;
+        }
+
+        /* Matchers index tables by letter once a word is marked as all
+         * letters */
+        if (wordInfo[id] & WORD_ALPHA_BIT) {
+            const unsigned char *word = (unsigned char*) folded + offsets[id];
+            for (uint32_t i = 0; i < length; i++) {
+                if ((unsigned char) (word[i] - 'a') >= 26) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (!are_starts_in_order(section_data(mapping, header,
+            SECTION_LENGTH_STARTS), header->maxWordLength + 1, words) ||
+            !are_ids_below(section_data(mapping, header, SECTION_LENGTH_IDS),
+            words, words)) {
+        return false;
+    }
+    return !(header->flags & HAS_SORT_RANKS) || (are_ids_below(section_data(
+            mapping, header, SECTION_SORT_RANKS), words, words) &&
+            are_ids_below(section_data(mapping, header, SECTION_SORTED_IDS),
+            words, words));
+}
+
+/**
+ * Checks that the bitsets of each length group are laid out as
+ * letter_index_build() lays them out, and that no bit past the end of a
+ * group is set where a search could turn it into an id.
+ *
+ * Parameters:
+ *  mapping - the start of the mapped file
+ *  header - the header of the file
+ *
+ * Returns true if the letter index is consistent
+ * */
+static bool is_letter_index_consistent(char *mapping, IndexHeader *header) {
+    int *lengthStarts = section_data(mapping, header, SECTION_LENGTH_STARTS);
+    size_t *groupOffsets = section_data(mapping, header,
+            SECTION_LETTER_GROUP_OFFSETS);
+    int *groupBlocks = section_data(mapping, header,
+            SECTION_LETTER_GROUP_BLOCKS);
+    uint64_t *bits = section_data(mapping, header, SECTION_LETTER_BITS);
+    int blockBits = 8 * sizeof(uint64_t);
+
+    uint64_t totalBlocks = 0;
+    for (int length = 0; length <= header->maxWordLength; length++) {
+        int groupSize = lengthStarts[length + 1] - lengthStarts[length];
+        int blocks = (groupSize + blockBits - 1) / blockBits;
+        if (groupOffsets[length] != totalBlocks ||
+                groupBlocks[length] != blocks) {
+            return false;
+        }
+        totalBlocks += (uint64_t) (1 + length * ALPHABET_SIZE) * blocks;
+        if (totalBlocks > header->letterBitsSize) {
+            return false;
+        }
+
+        /* Matches start from the alphabetic words' bitset */
+        if (groupSize % blockBits && bits[groupOffsets[length] + blocks - 1] >>
+                (groupSize % blockBits)) {
+            return false;
+        }
+    }
+    return totalBlocks == header->letterBitsSize;
+}
+
+/**
+ * Checks that the word graph only leads to nodes built before the node
+ * the edge leaves, as dawg_build() registers them, and that every node's
+ * word count is what its edges add up to. Walks then never loop and never
+ * take a rank past the last one.
+ *
+ * Parameters:
+ *  mapping - the start of the mapped file
+ *  header - the header of the file
+ *
+ * Returns true if the graph is consistent
+ * */
+static bool is_dawg_consistent(char *mapping, IndexHeader *header) {
+    int nodes = header->dawgNodeCount;
+    int ranks = header->dawgRankCount;
+    int *nodeFirstEdge = section_data(mapping, header,
+            SECTION_DAWG_NODE_FIRST_EDGE);
+    int *nodeWords = section_data(mapping, header, SECTION_DAWG_NODE_WORDS);
+    unsigned char *nodeFinal = section_data(mapping, header,
+            SECTION_DAWG_NODE_FINAL);
+    int *edgeTargets = section_data(mapping, header,
+            SECTION_DAWG_EDGE_TARGETS);
+    int *rankStarts = section_data(mapping, header, SECTION_DAWG_RANK_STARTS);
+
+    if (!are_starts_in_order(nodeFirstEdge, nodes, header->dawgEdgeCount)) {
+        return false;
+    }
+    for (int node = 0; node < nodes; node++) {
+        if (nodeFinal[node] > 1) {
+            return false;
+        }
+        int64_t words = nodeFinal[node];
+        for (int edge = nodeFirstEdge[node]; edge < nodeFirstEdge[node + 1];
+                edge++) {
+            if (edgeTargets[edge] < 0 || edgeTargets[edge] >= node) {
+                return false;
+            }
+            words += nodeWords[edgeTargets[edge]];
+        }
+        if (words != nodeWords[node]) {
+            return false;
+        }
+    }
+    if (nodeWords[header->dawgRoot] != ranks) {
+        return false;
+    }
+
+    int64_t rankIdCount = header->sections[SECTION_DAWG_RANK_IDS].size /
+            sizeof(int);
+    return are_starts_in_order(rankStarts, ranks, rankIdCount) &&
+            are_ids_below(section_data(mapping, header,
+            SECTION_DAWG_RANK_IDS), rankIdCount, header->wordCount);
+}
+
+/**
+ * Checks that the FM-index only holds known codes, that its code counts
+ * and sampled occurrences are those of its transform, and that suffix
+ * array entries, word starts and word ids are in range, so backward
+ * searches stay inside the suffix array and the words.
+ *
+ * Parameters:
+ *  mapping - the start of the mapped file
+ *  header - the header of the file
+ *
+ * Returns true if the FM-index is consistent
+ * */
+static bool is_fm_index_consistent(char *mapping, IndexHeader *header) {
+    int textSize = header->fmTextSize;
+    int wordCount = header->fmWordCount;
+    int *counts = header->fmCounts;
+    uint8_t *bwt = section_data(mapping, header, SECTION_FM_BWT);
+    int *occurrences = section_data(mapping, header, SECTION_FM_OCCURRENCES);
+
+    /* A text without words is only its end marker, code 0 */
+    if (textSize < 1 || (wordCount == 0 && (textSize != 1 ||
+            counts[1] != 1))) {
+        return false;
+    }
+    if (counts[0] != 0 || counts[FM_ALPHABET_SIZE] != textSize) {
+        return false;
+    }
+    for (int code = 0; code < FM_ALPHABET_SIZE; code++) {
+        if (counts[code + 1] < counts[code]) {
+            return false;
+        }
+    }
+
+    int running[FM_ALPHABET_SIZE] = {0};
+    for (int i = 0; i <= textSize; i++) {
+        if (i % FM_SAMPLE_RATE == 0 && memcmp(occurrences + (size_t)
+                (i / FM_SAMPLE_RATE) * FM_ALPHABET_SIZE, running,
+                sizeof(running))) {
+            return false;
+        }
+        if (i == textSize) {
+            break;
+        }
+        if (bwt[i] >= FM_ALPHABET_SIZE) {
+            return false;
+        }
+        running[bwt[i]]++;
+    }
+    for (int code = 0; code < FM_ALPHABET_SIZE; code++) {
+        if (running[code] != counts[code + 1] - counts[code]) {
+            return false;
+        }
+    }
+
+    return are_ids_below(section_data(mapping, header,
+            SECTION_FM_SUFFIX_ARRAY), textSize, textSize) &&
+            are_starts_in_order(section_data(mapping, header,
+            SECTION_FM_WORD_STARTS), wordCount, textSize - 1) &&
+            are_ids_below(section_data(mapping, header, SECTION_FM_WORD_IDS),
+            wordCount, header->wordCount);
+}
+
+/**
+ * Checks what the sections hold, so a corrupt index is never trusted
+ * with anything that is used as an index into another section. The
+ * counts must already agree with the section sizes.
+ *
+ * Parameters:
+ *  mapping - the start of the mapped file
+ *  header - the header of the file
+ *
+ * Returns true if the sections are consistent
+ * */
+static bool are_sections_consistent(char *mapping, IndexHeader *header) {
+    return are_words_consistent(mapping, header) &&
+            (!(header->flags & HAS_LETTER_INDEX) ||
+            is_letter_index_consistent(mapping, header)) &&
+            (!(header->flags & HAS_DAWG) ||
+            is_dawg_consistent(mapping, header)) &&
+            (!(header->flags & HAS_FM_INDEX) ||
+            is_fm_index_consistent(mapping, header));
+}
+
+/**
+ * Builds the dictionary and query index structures over a mapped file.
+ *
+ * Parameters:
+ *  mapping - the start of the mapped file
+ *  mappingSize - the size of the file
+ *
+ * Returns the dictionary, which owns the mapping
+ * */
+static DictionaryWords *attach_dictionary(char *mapping, size_t mappingSize) {
+    IndexHeader *header = (IndexHeader*) mapping;
+    DictionaryWords *dict = dict_words_init();
+    free(dict->arena);
+    dict->indexMapping = mapping;
+    dict->indexMappingSize = mappingSize;
+    dict->arena = section_data(mapping, header, SECTION_ARENA);
+    dict->arenaSize = header->arenaSize;
+    dict->arenaMemsize = header->arenaSize;
+    dict->offsets = section_data(mapping, header, SECTION_OFFSETS);
+    dict->folded = section_data(mapping, header, SECTION_FOLDED);
+    dict->wordInfo = section_data(mapping, header, SECTION_WORD_INFO);
+    dict->letterSigs = section_data(mapping, header, SECTION_LETTER_SIGS);
+    dict->size = header->wordCount;
+    dict->memsize = header->wordCount;
+    dict->maxWordLength = header->maxWordLength;
+    dict->lengthStarts = section_data(mapping, header, SECTION_LENGTH_STARTS);
+    dict->lengthIds = section_data(mapping, header, SECTION_LENGTH_IDS);
+    if (header->flags & HAS_SORT_RANKS) {
+        dict->sortRanks = section_data(mapping, header, SECTION_SORT_RANKS);
+        dict->sortedIds = section_data(mapping, header, SECTION_SORTED_IDS);
+        dict->isSortMapped = true;
+    }
+
+    if (header->flags & HAS_LETTER_INDEX) {
+        LetterIndex *letters = (LetterIndex*) malloc(sizeof(LetterIndex));
+        letters->maxWordLength = header->maxWordLength;
+        letters->groupOffsets = section_data(mapping, header,
+                SECTION_LETTER_GROUP_OFFSETS);
+        letters->groupBlocks = section_data(mapping, header,
+                SECTION_LETTER_GROUP_BLOCKS);
+        letters->bits = section_data(mapping, header, SECTION_LETTER_BITS);
+        letters->bitsSize = header->letterBitsSize;
+        dict->letterIndex = letters;
+        dict->isLetterIndexMapped = true;
+    }
+
+    if (header->flags & HAS_DAWG) {
+        Dawg *dawg = (Dawg*) malloc(sizeof(Dawg));
+        dawg->root = header->dawgRoot;
+        dawg->nodeCount = header->dawgNodeCount;
+        dawg->nodeFirstEdge = section_data(mapping, header,
+                SECTION_DAWG_NODE_FIRST_EDGE);
+        dawg->nodeWords = section_data(mapping, header,
+                SECTION_DAWG_NODE_WORDS);
+        dawg->nodeFinal = section_data(mapping, header,
+                SECTION_DAWG_NODE_FINAL);
+        dawg->edgeCount = header->dawgEdgeCount;
+        dawg->edgeLetters = section_data(mapping, header,
+                SECTION_DAWG_EDGE_LETTERS);
+        dawg->edgeTargets = section_data(mapping, header,
+                SECTION_DAWG_EDGE_TARGETS);
+        dawg->rankCount = header->dawgRankCount;
+        dawg->rankStarts = section_data(mapping, header,
+                SECTION_DAWG_RANK_STARTS);
+        dawg->rankIds = section_data(mapping, header, SECTION_DAWG_RANK_IDS);
+        dict->dawg = dawg;
+        dict->isDawgMapped = true;
+    }
+
+    if (header->flags & HAS_FM_INDEX) {
+        FmIndex *fm = (FmIndex*) malloc(sizeof(FmIndex));
+        fm->textSize = header->fmTextSize;
+        fm->bwt = section_data(mapping, header, SECTION_FM_BWT);
+        fm->suffixArray = section_data(mapping, header,
+                SECTION_FM_SUFFIX_ARRAY);
+        memcpy(fm->counts, header->fmCounts, sizeof(fm->counts));
+        fm->occurrences = section_data(mapping, header,
+                SECTION_FM_OCCURRENCES);
+        fm->wordCount = header->fmWordCount;
+        fm->wordStarts = section_data(mapping, header,
+                SECTION_FM_WORD_STARTS);
+        fm->wordIds = section_data(mapping, header, SECTION_FM_WORD_IDS);
+        dict->fmIndex = fm;
+        dict->isFmIndexMapped = true;
+    }
+
+    return dict;
+}
+
+IndexStatus index_file_load(char *indexFilename, DictionaryWords **dict,
+        char *sourceFilename) {
+    int fd = open(indexFilename, O_RDONLY);
+    struct stat info;
+    char *mapping = MAP_FAILED;
+
+    if (fd != -1 && fstat(fd, &info) != -1 &&
+            (size_t) info.st_size >= sizeof(IndexHeader)) {
+        /* Shared and read only, so every process searching the same
+         * index shares its pages */
+        mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (mapping == MAP_FAILED) {
+        return INDEX_NOT_AN_INDEX;
+    }
+
+    IndexHeader *header = (IndexHeader*) mapping;
+    IndexStatus status = INDEX_OK;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC))) {
+        status = INDEX_NOT_AN_INDEX;
+    } else if (header->version != INDEX_VERSION) {
+        status = INDEX_BAD_VERSION;
+    } else {
+        for (int id = 0; id < SECTION_COUNT; id++) {
+            IndexSection *section = &header->sections[id];
+            if (section->offset > (uint64_t) info.st_size ||
+                    section->size > (uint64_t) info.st_size -
+                    section->offset) {
+                status = INDEX_CORRUPT;
+            }
+        }
+        if (status == INDEX_OK && !are_counts_consistent(mapping, header)) {
+            status = INDEX_CORRUPT;
+        }
+    }
+    if (status == INDEX_OK || status == INDEX_CORRUPT) {
+        memcpy(sourceFilename, header->sourceFilename, PATH_MAX);
+        sourceFilename[PATH_MAX - 1] = 0;
+    }
+    if (status == INDEX_OK && !is_source_unchanged(header)) {
+        status = INDEX_STALE;
+    }
+    if (status == INDEX_OK && !are_sections_consistent(mapping, header)) {
+        status = INDEX_CORRUPT;
+    }
+
+    if (status != INDEX_OK) {
+        munmap(mapping, info.st_size);
+        return status;
+    }
+    *dict = attach_dictionary(mapping, info.st_size);
+    return INDEX_OK;
+}
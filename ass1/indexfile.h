@@ -0,0 +1,67 @@
+#ifndef INDEXFILE_H_
+#define INDEXFILE_H_
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* The bytes every index file starts with */
+#define INDEX_MAGIC "SRCHIDX"
+
+/* Bumped whenever the layout of an index file changes */
+#define INDEX_VERSION 4
+
+/* Why an index file could or could not be used */
+typedef enum {
+    INDEX_OK, INDEX_NOT_AN_INDEX, INDEX_BAD_VERSION, INDEX_STALE,
+    INDEX_CORRUPT
+} IndexStatus;
+
+/**
+ * Checks whether a file starts with the index file magic. Only regular
+ * files are looked at, so nothing is read from a pipe.
+ *
+ * Parameters:
+ *  filename - the file to check
+ *
+ * Returns true if the file looks like an index file
+ * */
+bool is_index_file(char *filename);
+
+/**
+ * Writes a dictionary, its folded copy, word info, letter signatures,
+ * length groups, sort ranks and any query indexes it carries to an index
+ * file. The file is written under a temporary name and renamed into place
+ * so processes mapping an older index are not disturbed.
+ *
+ * Parameters:
+ *  dict - the dictionary to save
+ *  sourceFilename - the word list the dictionary was read from
+ *  indexFilename - the index file to create
+ *
+ * Returns true on success, false if the file could not be written
+ * */
+bool index_file_write(DictionaryWords *dict, char *sourceFilename,
+        char *indexFilename);
+
+/**
+ * Maps an index file and builds a dictionary whose words, length groups
+ * and query indexes point straight into the mapping. The index is only
+ * used if the word list it was built from is unchanged since. An index
+ * whose header counts disagree with its section sizes, or whose sections
+ * hold ids, offsets or starts that lead outside them, is corrupt and is
+ * never mapped for searching.
+ *
+ * Parameters:
+ *  indexFilename - the index file to load
+ *  dict - set to the dictionary when INDEX_OK is returned
+ *  sourceFilename - a buffer of at least PATH_MAX bytes that is set to
+ *      the word list the index was built from when INDEX_OK, INDEX_STALE
+ *      or INDEX_CORRUPT is returned
+ *
+ * Returns INDEX_OK, or why the index could not be used
+ * */
+IndexStatus index_file_load(char *indexFilename, DictionaryWords **dict,
+        char *sourceFilename);
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "letterindex.h"
+#include "utils.h"
+
+/* The number of bits in a bitset block */
+#define BLOCK_BITS 64
+
+/* How many blocks are intersected at a time, small enough to stay in L1 */
+#define CHUNK_BLOCKS 64
+
+/**
+ * Gets the bitset of the words in a length group that hold a letter
+ * at a position.
+ *
+ * Parameters:
+ *  index - the letter index
+ *  length - the length group
+ *  position - the position in the word
+ *  letter - the letter, 0 for 'a'
+ *
+ * Returns the first block of the bitset
+ * */
+static uint64_t *letter_bits(LetterIndex *index, int length, int position,
+        int letter) {
+    return index->bits + index->groupOffsets[length] +
+            (size_t) (1 + position * ALPHABET_SIZE + letter) *
+            index->groupBlocks[length];
+}
+
+LetterIndex *letter_index_build(DictionaryWords *dict) {
+    LetterIndex *index = (LetterIndex*) malloc(sizeof(LetterIndex));
+    int maxLength = dict->maxWordLength;
+    index->maxWordLength = maxLength;
+    index->groupOffsets = (size_t*) malloc((maxLength + 1) * sizeof(size_t));
+    index->groupBlocks = (int*) malloc((maxLength + 1) * sizeof(int));
+
+    size_t totalBlocks = 0;
+    for (int length = 0; length <= maxLength; length++) {
+        int groupSize = dict->lengthStarts[length + 1] -
+                dict->lengthStarts[length];
+        index->groupOffsets[length] = totalBlocks;
+        index->groupBlocks[length] = (groupSize + BLOCK_BITS - 1) / BLOCK_BITS;
+        totalBlocks += (size_t) (1 + length * ALPHABET_SIZE) *
+                index->groupBlocks[length];
+    }
+    index->bits = (uint64_t*) calloc(totalBlocks ? totalBlocks : 1,
+            sizeof(uint64_t));
+    index->bitsSize = totalBlocks;
+
+    for (int length = 0; length <= maxLength; length++) {
+        uint64_t *alphaBits = index->bits + index->groupOffsets[length];
+        int groupStart = dict->lengthStarts[length];
+        int groupSize = dict->lengthStarts[length + 1] - groupStart;
+
+        for (int member = 0; member < groupSize; member++) {
+            int id = dict->lengthIds[groupStart + member];
+            if (!(dict->wordInfo[id] & WORD_ALPHA_BIT)) {
+                continue; // never matches, leave all its bits clear
+            }
+
+            char *word = dict->folded + dict->offsets[id];
+            uint64_t bit = (uint64_t) 1 << (member % BLOCK_BITS);
+            alphaBits[member / BLOCK_BITS] |= bit;
+            for (int position = 0; position < length; position++) {
+                letter_bits(index, length, position,
+                        word[position] - 'a')[member / BLOCK_BITS] |= bit;
+            }
+        }
+    }
+
+    return index;
+}
+
+/**
+ * Adds the words of one length group that match the pattern's fixed
+ * letters to a match set.
+ *
+ * Parameters:
+ *  index - the letter index
+ *  dict - the dictionary the index was built over
+ *  length - the length group to search
+ *  pattern - the pattern to match, no longer than length
+ *  matches - the match set to add the ids to
+ *
+ * Returns nothing
+ * */
+static void match_length_group(LetterIndex *index, DictionaryWords *dict,
+        int length, char *pattern, DictionaryWords *matches) {
+    int blocks = index->groupBlocks[length];
+    uint64_t *alphaBits = index->bits + index->groupOffsets[length];
+    int groupStart = dict->lengthStarts[length];
+
+    int fixedCount = 0;
+    uint64_t *fixedBits[strlen(pattern) + 1];
+    for (int position = 0; pattern[position]; position++) {
+        if (pattern[position] != '?') {
+            fixedBits[fixedCount++] = letter_bits(index, length, position,
+                    tolower(pattern[position]) - 'a');
+        }
+    }
+
+    uint64_t chunk[CHUNK_BLOCKS];
+    for (int first = 0; first < blocks; first += CHUNK_BLOCKS) {
+        int chunkBlocks = blocks - first < CHUNK_BLOCKS ?
+                blocks - first : CHUNK_BLOCKS;
+
+        memcpy(chunk, alphaBits + first, chunkBlocks * sizeof(uint64_t));
+        for (int fixed = 0; fixed < fixedCount; fixed++) {
+            uint64_t *bits = fixedBits[fixed] + first;
+            for (int block = 0; block < chunkBlocks; block++) {
+                chunk[block] &= bits[block];
+            }
+        }
+
+        for (int block = 0; block < chunkBlocks; block++) {
+            uint64_t found = chunk[block];
+            while (found) {
+                int member = (first + block) * BLOCK_BITS +
+                        __builtin_ctzll(found);
+                dict_words_add_id(matches,
+                        dict->lengthIds[groupStart + member]);
+                found &= found - 1;
+            }
+        }
+    }
+}
+
+DictionaryWords *letter_index_match(LetterIndex *index, DictionaryWords *dict,
+        char *pattern, bool isPrefix) {
+    DictionaryWords *matches = dict_words_init_matches(dict);
+    int patternLength = strlen(pattern);
+    int lastLength = isPrefix ? index->maxWordLength : patternLength;
+    int groupsMatched = 0;
+
+    for (int length = patternLength; length <= lastLength &&
+            length <= index->maxWordLength; length++) {
+        int matchesBefore = matches->size;
+        match_length_group(index, dict, length, pattern, matches);
+        if (matches->size > matchesBefore) {
+            groupsMatched++;
+        }
+    }
+
+    /* Each group is in dictionary order but the groups need merging */
+    if (groupsMatched > 1) {
+        qsort(matches->ids, matches->size, sizeof(int), compare_ids);
+    }
+
+    return matches;
+}
+
+void letter_index_free(LetterIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+    free(index->groupOffsets);
+    free(index->groupBlocks);
+    free(index->bits);
+    free(index);
+}
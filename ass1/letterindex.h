@@ -0,0 +1,63 @@
+#ifndef LETTERINDEX_H_
+#define LETTERINDEX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+/* The number of letters a position in a word can hold */
+#define ALPHABET_SIZE 26
+
+/* Bitsets of words keyed by (length, position, letter).
+ *
+ * Bits are numbered by a word's place in its length group (see
+ * DictionaryWords lengthIds) so each bitset only covers words that could
+ * ever be compared with it. For length L the group's bitsets start at
+ * bits[groupOffsets[L]], each groupBlocks[L] blocks long: first the set of
+ * all alphabetic words, then one set for every position and letter. */
+struct LetterIndex {
+    int maxWordLength;
+    size_t *groupOffsets;
+    int *groupBlocks;
+    uint64_t *bits;
+    size_t bitsSize; /* the number of blocks in bits */
+};
+
+/**
+ * Builds the positional letter index over all the words in a dictionary.
+ * The dictionary must already be normalized and have its length groups.
+ *
+ * Parameters:
+ *  dict - the dictionary to index
+ *
+ * Returns the index, free it with letter_index_free()
+ * */
+LetterIndex *letter_index_build(DictionaryWords *dict);
+
+/**
+ * Finds the words matching a pattern by intersecting the bitsets of its
+ * fixed letters. Words that are not all alphabetic never match.
+ *
+ * Parameters:
+ *  index - the letter index of the dictionary
+ *  dict - the dictionary the index was built over
+ *  pattern - the pattern of letters and '?' to match
+ *  isPrefix - whether longer words may match too, as with -prefix
+ *
+ * Returns the match set in dictionary order
+ * */
+DictionaryWords *letter_index_match(LetterIndex *index, DictionaryWords *dict,
+        char *pattern, bool isPrefix);
+
+/**
+ * Frees all the memory held by the index
+ *
+ * Parameters:
+ *  index - the index to free
+ *
+ * Returns nothing
+ * */
+void letter_index_free(LetterIndex *index);
+
+#endif
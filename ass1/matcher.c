@@ -0,0 +1,195 @@
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS
+#endif
+
+#include "matcher.h"
+
+/* The letters from the most to the least common in English words */
+#define LETTERS_BY_FREQUENCY "esiarntolcdupmghbyfvkwzxqj"
+
+/**
+ * Compares a folded word with the pattern one letter at a time following
+ * the plan. Used when no kernel is available or the bytes it reads can't
+ * be read safely.
+ *
+ * Parameters:
+ *  compiled - the prepared pattern
+ *  word - the folded word to check
+ *
+ * Returns true if the word matches
+ * */
+static bool scalar_match(const CompiledPattern *compiled, const char *word) {
+    for (int i = 0; i < compiled->planLength; i++) {
+        if (word[compiled->planPositions[i]] != compiled->planLetters[i]) {
+            return false;
+        }
+    }
+    for (int i = MATCH_PLAN_SIZE; i < compiled->length; i++) {
+        if (compiled->pattern[i] != '?' &&
+                tolower(compiled->pattern[i]) != word[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Lays out the plan, the fixed letters of the first MATCH_PLAN_SIZE
+ * positions ordered from the rarest letter to the most common, and the
+ * 64 bit form of a short pattern.
+ *
+ * Parameters:
+ *  compiled - the pattern being prepared, its folded letters set
+ *  pattern - the pattern
+ *
+ * Returns nothing
+ * */
+static void plan_pattern(CompiledPattern *compiled, const char *pattern) {
+    const char *byFrequency = LETTERS_BY_FREQUENCY;
+    for (int rank = SHIFT_OR_LETTERS - 1; rank >= 0; rank--) {
+        for (int i = 0; i < compiled->length && i < MATCH_PLAN_SIZE; i++) {
+            if (pattern[i] != '?' &&
+                    tolower(pattern[i]) == byFrequency[rank]) {
+                compiled->planPositions[compiled->planLength] = i;
+                compiled->planLetters[compiled->planLength] =
+                        byFrequency[rank];
+                compiled->planLength++;
+            }
+        }
+    }
+
+    if (compiled->length <= SHORT_PATTERN_LENGTH) {
+        uint8_t mask[SHORT_PATTERN_LENGTH] = {0};
+        for (int i = 0; i < compiled->length; i++) {
+            mask[i] = pattern[i] != '?' ? 0xff : 0;
+        }
+        compiled->isShort = true;
+        memcpy(&compiled->shortMask, mask, sizeof(uint64_t));
+        memcpy(&compiled->shortLetters, compiled->folded, sizeof(uint64_t));
+    }
+}
+
+#ifdef HAS_X86_KERNELS
+
+/**
+ * The SSE2 block kernel, two 16 byte compares
+ *
+ * Parameters:
+ *  compiled - the prepared pattern
+ *  word - the folded word, MATCH_BLOCK_SIZE bytes must be readable
+ *
+ * Returns true if the fixed letters of the pattern match
+ * */
+__attribute__((target("sse2")))
+static bool match_block_sse2(const CompiledPattern *compiled,
+        const char *word) {
+    uint32_t same = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*) word),
+            _mm_loadu_si128((const __m128i*) compiled->folded)));
+    if (compiled->length > 16) {
+        same |= (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*) (word + 16)),
+                _mm_loadu_si128((const __m128i*) (compiled->folded + 16))))
+                << 16;
+    }
+
+    return (~same & compiled->fixedMask) == 0;
+}
+
+/**
+ * The AVX2 block kernel, one 32 byte compare
+ *
+ * Parameters:
+ *  compiled - the prepared pattern
+ *  word - the folded word, MATCH_BLOCK_SIZE bytes must be readable
+ *
+ * Returns true if the fixed letters of the pattern match
+ * */
+__attribute__((target("avx2")))
+static bool match_block_avx2(const CompiledPattern *compiled,
+        const char *word) {
+    __m256i equal = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*) word),
+            _mm256_loadu_si256((const __m256i*) compiled->folded));
+
+    return (~(uint32_t) _mm256_movemask_epi8(equal) &
+            compiled->fixedMask) == 0;
+}
+
+#endif
+
+void compile_pattern(CompiledPattern *compiled, char *pattern) {
+    memset(compiled, 0, sizeof(CompiledPattern));
+    compiled->pattern = pattern;
+    compiled->length = strlen(pattern);
+
+    for (int i = 0; i < compiled->length; i++) {
+        if (pattern[i] != '?') {
+            compiled->needLetters |= 1u << (tolower(pattern[i]) - 'a');
+        }
+    }
+    for (int i = 0; i < compiled->length && i < MATCH_BLOCK_SIZE; i++) {
+        if (pattern[i] != '?') {
+            compiled->folded[i] = tolower(pattern[i]);
+            compiled->fixedMask |= 1u << i;
+        }
+    }
+    plan_pattern(compiled, pattern);
+
+    if (compiled->length <= SHIFT_OR_MAX_LENGTH) {
+        compiled->hasShiftMasks = true;
+        for (int letter = 0; letter < SHIFT_OR_LETTERS; letter++) {
+            compiled->shiftMasks[letter] = ~(uint64_t) 0;
+        }
+        for (int i = 0; i < compiled->length; i++) {
+            for (int letter = 0; letter < SHIFT_OR_LETTERS; letter++) {
+                if (pattern[i] == '?' || tolower(pattern[i]) == 'a' + letter) {
+                    compiled->shiftMasks[letter] &= ~((uint64_t) 1 << i);
+                }
+            }
+        }
+    }
+
+    if (compiled->length > MATCH_BLOCK_SIZE) {
+        return;
+    }
+#ifdef HAS_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        compiled->kernel = match_block_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        compiled->kernel = match_block_sse2;
+    }
+#endif
+}
+
+bool compiled_pattern_match(const CompiledPattern *compiled, const char *word,
+        size_t readableBytes) {
+    if (compiled->isShort && readableBytes >= sizeof(uint64_t)) {
+        uint64_t letters;
+        memcpy(&letters, word, sizeof(uint64_t));
+        return (letters & compiled->shortMask) == compiled->shortLetters;
+    }
+    if (compiled->kernel == NULL || readableBytes < MATCH_BLOCK_SIZE) {
+        return scalar_match(compiled, word);
+    }
+    return compiled->kernel(compiled, word);
+}
+
+bool compiled_pattern_find(const CompiledPattern *compiled, const char *word,
+        int wordLength) {
+    if (compiled->length == 0) {
+        return true;
+    }
+
+    uint64_t state = ~(uint64_t) 0;
+    uint64_t found = 0;
+    for (int i = 0; i < wordLength; i++) {
+        state = (state << 1) | compiled->shiftMasks[word[i] - 'a'];
+        found |= ~state;
+    }
+    return (found >> (compiled->length - 1)) & 1;
+}
@@ -0,0 +1,107 @@
+#ifndef MATCHER_H_
+#define MATCHER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The most bytes of a word the block kernels compare at once */
+#define MATCH_BLOCK_SIZE 32
+
+/* The longest pattern the shift-or search can find, one bit a position */
+#define SHIFT_OR_MAX_LENGTH 64
+
+/* The number of letters a shift-or mask is kept for */
+#define SHIFT_OR_LETTERS 26
+
+/* The most positions a matching plan covers, the rest of a longer
+ * pattern is checked in order after the plan */
+#define MATCH_PLAN_SIZE 64
+
+/* The longest pattern compared as one 64 bit word */
+#define SHORT_PATTERN_LENGTH 8
+
+/* A pattern prepared once per query so each folded word can be checked
+ * with a single block compare.
+ *
+ * folded holds the lowercase pattern letters, with zeroes for '?' and
+ * past the end of the pattern. Bit i of fixedMask is set when position i
+ * is a letter rather than a '?'. kernel is the fastest block compare the
+ * CPU supports, or NULL when only the scalar loop can be used.
+ *
+ * Bit n of needLetters is set when the pattern holds the nth letter, for
+ * testing against a word's letter signature before matching it.
+ *
+ * For patterns of up to SHIFT_OR_MAX_LENGTH positions shiftMasks holds,
+ * per letter, a mask with bit i clear when position i is that letter or
+ * a '?', so a search anywhere in a word is one shift and or per letter.
+ *
+ * The plan is what the letter by letter compare runs: the folded fixed
+ * letters and their positions, the rarest letter in English first so
+ * most words fail on the first test. Patterns of up to
+ * SHORT_PATTERN_LENGTH are also kept as shortLetters, their folded
+ * letters in the bytes shortMask keeps, for a single 64 bit compare. */
+typedef struct CompiledPattern CompiledPattern;
+struct CompiledPattern {
+    char *pattern;
+    int length;
+    uint8_t folded[MATCH_BLOCK_SIZE];
+    uint32_t fixedMask;
+    uint32_t needLetters;
+    bool (*kernel)(const CompiledPattern *compiled, const char *word);
+    bool hasShiftMasks;
+    uint64_t shiftMasks[SHIFT_OR_LETTERS];
+    int planLength;
+    uint8_t planPositions[MATCH_PLAN_SIZE];
+    char planLetters[MATCH_PLAN_SIZE];
+    bool isShort;
+    uint64_t shortMask;
+    uint64_t shortLetters;
+};
+
+/**
+ * Prepares a pattern for matching and picks the block kernel to use
+ *
+ * Parameters:
+ *  compiled - where to store the prepared pattern
+ *  pattern - the pattern of letters and '?', kept by reference
+ *
+ * Returns nothing
+ * */
+void compile_pattern(CompiledPattern *compiled, char *pattern);
+
+/**
+ * Checks that the first letters of a word match the pattern. The word
+ * must be folded to lower case, all alphabetic and at least as long as
+ * the pattern; exact and prefix searches check these themselves.
+ *
+ * A short pattern is compared as one 64 bit word and a longer one as a
+ * whole block, when enough bytes can be read from the start of the word.
+ * Otherwise the plan is followed letter by letter.
+ *
+ * Parameters:
+ *  compiled - the prepared pattern
+ *  word - the folded word to check
+ *  readableBytes - how many bytes may be read from the start of the word
+ *
+ * Returns true if the word matches
+ * */
+bool compiled_pattern_match(const CompiledPattern *compiled, const char *word,
+        size_t readableBytes);
+
+/**
+ * Checks that the pattern occurs somewhere in a word with a shift-or
+ * search in a single pass over the word. The word must be folded to lower
+ * case and all alphabetic. Only for patterns with shiftMasks.
+ *
+ * Parameters:
+ *  compiled - the prepared pattern
+ *  word - the folded word to search
+ *  wordLength - the length of the word
+ *
+ * Returns true if the word matches
+ * */
+bool compiled_pattern_find(const CompiledPattern *compiled, const char *word,
+        int wordLength);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "merge.h"
+#include "utils.h"
+
+/* Marks an empty slot of the hash set */
+#define EMPTY_SLOT -1
+
+/* How many words ahead the slot of a word is prefetched */
+#define PREFETCH_DISTANCE 8
+
+/* A slot of the hash set. The full hash is kept so most other words are
+ * told apart without reading them. */
+typedef struct {
+    uint32_t hash;
+    int id;
+} Slot;
+
+/**
+ * Hashes a folded word with 32 bit FNV-1a.
+ *
+ * Parameters:
+ *  word - the folded word
+ *  length - its length
+ *
+ * Returns the hash
+ * */
+static uint32_t hash_word(const char *word, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) word[i]) * 16777619u;
+    }
+    return hash;
+}
+
+DictionaryWords *merge_dictionaries(DictionaryWords **dicts, int count) {
+    size_t arenaSize = 0;
+    int totalWords = 0;
+    for (int i = 0; i < count; i++) {
+        arenaSize += dicts[i]->arenaSize;
+        totalWords += dicts[i]->size;
+    }
+
+    DictionaryWords *merged = dict_words_init();
+    merged->arena = (char*) realloc(merged->arena, arenaSize + 1);
+    merged->arenaMemsize = arenaSize + 1;
+    dict_words_reserve(merged, totalWords);
+
+    /* The set holds ids of merged words, at most half full. Their folded
+     * copies are still in the dictionaries they came from. */
+    uint32_t mask = 1;
+    while (mask < 2 * (uint32_t) totalWords) {
+        mask *= 2;
+    }
+    mask--;
+    Slot *slots = (Slot*) malloc((mask + 1) * sizeof(Slot));
+    for (uint32_t slot = 0; slot <= mask; slot++) {
+        slots[slot].id = EMPTY_SLOT;
+    }
+    const char **foldedWords = (const char**) malloc((totalWords + 1) *
+            sizeof(char*));
+
+    uint32_t *hashes = NULL;
+    for (int i = 0; i < count; i++) {
+        DictionaryWords *dict = dicts[i];
+        hashes = (uint32_t*) realloc(hashes, (dict->size + 1) *
+                sizeof(uint32_t));
+        for (int id = 0; id < dict->size; id++) {
+            hashes[id] = hash_word(dict->folded + dict->offsets[id],
+                    dict->wordInfo[id] & WORD_LENGTH_MASK);
+        }
+
+        for (int id = 0; id < dict->size; id++) {
+            /* The slots are all over the set, so those of the words a
+             * little ahead are fetched while this one is probed */
+            if (id + PREFETCH_DISTANCE < dict->size) {
+                __builtin_prefetch(&slots[hashes[id + PREFETCH_DISTANCE] &
+                        mask]);
+            }
+            const char *folded = dict->folded + dict->offsets[id];
+            int length = dict->wordInfo[id] & WORD_LENGTH_MASK;
+            uint32_t hash = hashes[id];
+            uint32_t slot = hash & mask;
+            bool isDuplicate = false;
+            while (slots[slot].id != EMPTY_SLOT) {
+                int other = slots[slot].id;
+                if (slots[slot].hash == hash && (int) (merged->wordInfo[other]
+                        & WORD_LENGTH_MASK) == length &&
+                        !memcmp(foldedWords[other], folded, length)) {
+                    isDuplicate = true;
+                    break;
+                }
+                slot = (slot + 1) & mask;
+            }
+            if (isDuplicate) {
+                continue;
+            }
+            slots[slot].hash = hash;
+            slots[slot].id = merged->size;
+            foldedWords[merged->size] = folded;
+            dict_words_add(merged, dict->arena + dict->offsets[id], length);
+        }
+    }
+    free(hashes);
+    free(slots);
+    free(foldedWords);
+
+    dict_words_normalize(merged);
+    dict_words_index_lengths(merged);
+    return merged;
+}
@@ -0,0 +1,21 @@
+#ifndef MERGE_H_
+#define MERGE_H_
+
+#include "common.h"
+
+/**
+ * Joins several dictionaries into one with a single arena, dropping every
+ * word equal ignoring case to one before it. The words keep their order,
+ * those of the first dictionary coming first, so the first spelling of a
+ * word is the one kept whatever order the dictionaries were loaded in.
+ * Duplicates are found with a hash set of the folded words.
+ *
+ * Parameters:
+ *  dicts - the normalized dictionaries to join, left as they are
+ *  count - how many dictionaries there are
+ *
+ * Returns the joined dictionary, normalized and with its length groups
+ * */
+DictionaryWords *merge_dictionaries(DictionaryWords **dicts, int count);
+
+#endif
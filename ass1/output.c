@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "output.h"
+
+struct OutputWriter {
+    int fd;
+    char *buffer;
+    size_t used;
+    size_t segmentStart; /* where the buffered bytes not in iovecs start */
+    struct iovec iovecs[OUTPUT_MAX_IOVECS];
+    int iovecCount;
+    bool isBroken; /* a write failed, so the rest is dropped */
+};
+
+/* What follows every word written in place */
+static char newline[] = "\n";
+
+OutputWriter *output_writer_init(int fd) {
+    OutputWriter *writer = (OutputWriter*) malloc(sizeof(OutputWriter));
+    writer->fd = fd;
+    writer->buffer = (char*) malloc(OUTPUT_BUFFER_SIZE);
+    writer->used = 0;
+    writer->segmentStart = 0;
+    writer->iovecCount = 0;
+    writer->isBroken = false;
+    return writer;
+}
+
+/**
+ * Turns the buffered bytes not yet in an iovec into one, so an outside
+ * piece can follow them.
+ *
+ * Parameters:
+ *  writer - the writer
+ *
+ * Returns nothing
+ * */
+static void close_segment(OutputWriter *writer) {
+    if (writer->used > writer->segmentStart) {
+        writer->iovecs[writer->iovecCount].iov_base = writer->buffer +
+                writer->segmentStart;
+        writer->iovecs[writer->iovecCount].iov_len = writer->used -
+                writer->segmentStart;
+        writer->iovecCount++;
+        writer->segmentStart = writer->used;
+    }
+}
+
+/**
+ * Writes all the iovecs, continuing after partial writes.
+ *
+ * Parameters:
+ *  writer - the writer
+ *
+ * Returns nothing, isBroken is set if a write fails
+ * */
+static void write_iovecs(OutputWriter *writer) {
+    struct iovec *next = writer->iovecs;
+    int count = writer->iovecCount;
+    while (count > 0 && !writer->isBroken) {
+        ssize_t written = writev(writer->fd, next, count);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            writer->isBroken = true;
+            break;
+        }
+        while (count > 0 && (size_t) written >= next->iov_len) {
+            written -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = (char*) next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+}
+
+bool output_flush(OutputWriter *writer) {
+    close_segment(writer);
+    write_iovecs(writer);
+    writer->iovecCount = 0;
+    writer->used = 0;
+    writer->segmentStart = 0;
+    return !writer->isBroken;
+}
+
+/**
+ * Adds a piece of outside memory to the output without copying it.
+ *
+ * Parameters:
+ *  writer - the writer
+ *  data - the bytes, valid until the next flush
+ *  length - how many bytes
+ *
+ * Returns nothing
+ * */
+static void write_in_place(OutputWriter *writer, const char *data,
+        size_t length) {
+    /* Room for the piece and for closing the segment after it */
+    if (writer->iovecCount + 3 > OUTPUT_MAX_IOVECS) {
+        output_flush(writer);
+    }
+    close_segment(writer);
+    writer->iovecs[writer->iovecCount].iov_base = (char*) data;
+    writer->iovecs[writer->iovecCount].iov_len = length;
+    writer->iovecCount++;
+}
+
+void output_write(OutputWriter *writer, const char *data, size_t length) {
+    if (writer->used + length > OUTPUT_BUFFER_SIZE) {
+        output_flush(writer);
+    }
+    if (length > OUTPUT_BUFFER_SIZE) {
+        write_in_place(writer, data, length);
+        return;
+    }
+    memcpy(writer->buffer + writer->used, data, length);
+    writer->used += length;
+}
+
+void output_write_word(OutputWriter *writer, const char *word,
+        size_t length) {
+    if (length >= OUTPUT_ZERO_COPY_SIZE) {
+        write_in_place(writer, word, length);
+        write_in_place(writer, newline, 1);
+        return;
+    }
+    if (writer->used + length + 1 > OUTPUT_BUFFER_SIZE) {
+        output_flush(writer);
+    }
+    memcpy(writer->buffer + writer->used, word, length);
+    writer->buffer[writer->used + length] = '\n';
+    writer->used += length + 1;
+}
+
+bool output_writer_free(OutputWriter *writer) {
+    bool isWritten = output_flush(writer);
+    free(writer->buffer);
+    free(writer);
+    return isWritten;
+}
@@ -0,0 +1,77 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* How many bytes are gathered before they are written out */
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+/* Words at least this long are written from where they are rather than
+ * copied into the buffer */
+#define OUTPUT_ZERO_COPY_SIZE 256
+
+/* The most pieces handed to a single writev() */
+#define OUTPUT_MAX_IOVECS 1024
+
+/* Gathers output into large writes; see output_writer_init() */
+typedef struct OutputWriter OutputWriter;
+
+/**
+ * Creates a writer that gathers output for a file descriptor and writes
+ * it with as few writev() calls as it can. Short pieces are copied into a
+ * buffer and long words are written straight from their own memory, so
+ * they must stay valid until the next flush.
+ *
+ * Parameters:
+ *  fd - where the output goes
+ *
+ * Returns the writer, free it with output_writer_free()
+ * */
+OutputWriter *output_writer_init(int fd);
+
+/**
+ * Adds bytes to the output, copying them into the buffer.
+ *
+ * Parameters:
+ *  writer - the writer
+ *  data - the bytes to add
+ *  length - how many bytes
+ *
+ * Returns nothing
+ * */
+void output_write(OutputWriter *writer, const char *data, size_t length);
+
+/**
+ * Adds a word and a newline to the output.
+ *
+ * Parameters:
+ *  writer - the writer
+ *  word - the word, which must stay valid until the next flush
+ *  length - the length of the word
+ *
+ * Returns nothing
+ * */
+void output_write_word(OutputWriter *writer, const char *word, size_t length);
+
+/**
+ * Writes out everything gathered so far.
+ *
+ * Parameters:
+ *  writer - the writer
+ *
+ * Returns false if the output could not be written, now or before
+ * */
+bool output_flush(OutputWriter *writer);
+
+/**
+ * Flushes the writer and frees it.
+ *
+ * Parameters:
+ *  writer - the writer
+ *
+ * Returns false if the output could not be written
+ * */
+bool output_writer_free(OutputWriter *writer);
+
+#endif
@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "refresh.h"
+#include "utils.h"
+
+/* A delta with more than DELTA_MINIMUM words and more than the loaded
+ * words over DELTA_SHARE is folded into a full load instead */
+#define DELTA_MINIMUM 4096
+#define DELTA_SHARE 8
+
+/* The directory events that can mean a watched file changed */
+#define WATCH_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | \
+        IN_DELETE | IN_ATTRIB)
+
+struct BaseWords {
+    DictionaryWords *dict;
+    FrontCoded *coded;
+    int references;
+};
+
+/* What a file looked like when it was last read */
+typedef struct {
+    bool exists;
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+} FileState;
+
+struct Refresher {
+    WordsLoader loader;
+    void *context;
+    char wordsFilename[PATH_MAX];
+    char *indexFilename;
+    FileState words;
+    FileState index;
+    off_t wordsEnd; /* just past the last whole line read */
+    char tail[REFRESH_TAIL_SIZE]; /* the bytes before wordsEnd */
+    int tailSize;
+    char *deltaText; /* the lines appended since the last full load */
+    size_t deltaSize;
+    int inotifyFd;
+    pthread_mutex_t lock;
+    Snapshot *current;
+};
+
+/**
+ * Looks up what a file looks like now.
+ *
+ * Parameters:
+ *  filename - the file
+ *  state - where to put it, exists is false if the file is gone
+ *
+ * Returns nothing
+ * */
+static void read_file_state(char *filename, FileState *state) {
+    struct stat info;
+    memset(state, 0, sizeof(FileState));
+    if (stat(filename, &info) == -1) {
+        return;
+    }
+    state->exists = true;
+    state->device = info.st_dev;
+    state->inode = info.st_ino;
+    state->size = info.st_size;
+    state->modified = info.st_mtim;
+}
+
+/**
+ * Checks whether a file looks the same as before.
+ *
+ * Parameters:
+ *  first - one state of the file
+ *  second - the other
+ *
+ * Returns true if nothing about the file changed
+ * */
+static bool is_same_state(FileState *first, FileState *second) {
+    return first->exists == second->exists &&
+            first->device == second->device &&
+            first->inode == second->inode && first->size == second->size &&
+            first->modified.tv_sec == second->modified.tv_sec &&
+            first->modified.tv_nsec == second->modified.tv_nsec;
+}
+
+/**
+ * Reads part of a file in full.
+ *
+ * Parameters:
+ *  fd - the file
+ *  buffer - where to put the bytes
+ *  size - how many bytes to read
+ *  offset - where in the file to start
+ *
+ * Returns how many bytes were read, fewer at the end of the file
+ * */
+static size_t read_at(int fd, char *buffer, size_t size, off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = pread(fd, buffer + done, size - done, offset + done);
+        if (got <= 0) {
+            break;
+        }
+        done += got;
+    }
+    return done;
+}
+
+/**
+ * Keeps the bytes of the word list before wordsEnd, so a later change
+ * can be told to be an append.
+ *
+ * Parameters:
+ *  refresher - the refresher
+ *  fd - the word list
+ *
+ * Returns nothing
+ * */
+static void keep_tail(Refresher *refresher, int fd) {
+    refresher->tailSize = refresher->wordsEnd < REFRESH_TAIL_SIZE ?
+            refresher->wordsEnd : REFRESH_TAIL_SIZE;
+    refresher->tailSize = read_at(fd, refresher->tail, refresher->tailSize,
+            refresher->wordsEnd - refresher->tailSize);
+}
+
+/**
+ * Finds where the last whole line of the word list ends and keeps the
+ * bytes before it. A last line without a newline is not a word yet, as
+ * when loading.
+ *
+ * Parameters:
+ *  refresher - the refresher, whose words state is up to date
+ *
+ * Returns nothing
+ * */
+static void mark_words_end(Refresher *refresher) {
+    refresher->wordsEnd = 0;
+    refresher->tailSize = 0;
+    int fd = open(refresher->wordsFilename, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+
+    char buffer[4096];
+    off_t end = refresher->words.size;
+    while (end > 0 && refresher->wordsEnd == 0) {
+        off_t start = end > (off_t) sizeof(buffer) ? end - sizeof(buffer) : 0;
+        size_t got = read_at(fd, buffer, end - start, start);
+        char *newline = memrchr(buffer, '\n', got);
+        if (newline != NULL) {
+            refresher->wordsEnd = start + (newline - buffer) + 1;
+        }
+        end = start;
+    }
+
+    keep_tail(refresher, fd);
+    close(fd);
+}
+
+/**
+ * Makes a snapshot the current one and lets go of the one it replaces.
+ *
+ * Parameters:
+ *  refresher - the refresher
+ *  base - the loaded words of the new snapshot, referenced by it
+ *  delta - the appended words of the new snapshot, or NULL
+ *
+ * Returns nothing
+ * */
+static void swap_snapshot(Refresher *refresher, BaseWords *base,
+        DictionaryWords *delta) {
+    Snapshot *snapshot = (Snapshot*) malloc(sizeof(Snapshot));
+    snapshot->dict = base->dict;
+    snapshot->coded = base->coded;
+    snapshot->delta = delta;
+    snapshot->base = base;
+    snapshot->references = 1; /* held while it is current */
+
+    pthread_mutex_lock(&refresher->lock);
+    Snapshot *old = refresher->current;
+    snapshot->generation = old ? old->generation + 1 : 0;
+    refresher->current = snapshot;
+    pthread_mutex_unlock(&refresher->lock);
+
+    if (old != NULL) {
+        refresh_release(refresher, old);
+    }
+}
+
+/**
+ * Loads the words in full and makes them current, dropping any delta.
+ *
+ * Parameters:
+ *  refresher - the refresher
+ *
+ * Returns false if the words could not be loaded, the current snapshot
+ * is kept then
+ * */
+static bool reload_words(Refresher *refresher) {
+    LoadedWords loaded;
+    memset(&loaded, 0, sizeof(LoadedWords));
+    if (!refresher->loader(&loaded, refresher->context)) {
+        return false;
+    }
+
+    strcpy(refresher->wordsFilename, loaded.wordsFilename);
+    read_file_state(refresher->wordsFilename, &refresher->words);
+    if (refresher->indexFilename) {
+        read_file_state(refresher->indexFilename, &refresher->index);
+    }
+    mark_words_end(refresher);
+    refresher->deltaSize = 0;
+
+    BaseWords *base = (BaseWords*) malloc(sizeof(BaseWords));
+    base->dict = loaded.dict;
+    base->coded = loaded.coded;
+    base->references = 1;
+    swap_snapshot(refresher, base, NULL);
+    return true;
+}
+
+/**
+ * Adds the whole lines appended to the word list since it was last read
+ * to the delta and makes a snapshot with them current. Only the new part
+ * of the file is read, and only the delta is split and normalized again.
+ *
+ * Parameters:
+ *  refresher - the refresher
+ *  words - what the word list looks like now
+ *
+ * Returns false if the delta has grown too large and a full load is due
+ * */
+static bool append_words(Refresher *refresher, FileState *words) {
+    int fd = open(refresher->wordsFilename, O_RDONLY);
+    if (fd == -1) {
+        return true;
+    }
+    size_t length = words->size - refresher->wordsEnd;
+    refresher->deltaText = (char*) realloc(refresher->deltaText,
+            refresher->deltaSize + length + 1);
+    char *added = refresher->deltaText + refresher->deltaSize;
+    length = read_at(fd, added, length, refresher->wordsEnd);
+
+    refresher->words = *words;
+    char *newline = memrchr(added, '\n', length);
+    if (newline == NULL) {
+        close(fd);
+        return true;
+    }
+    length = newline + 1 - added;
+    refresher->deltaSize += length;
+    refresher->wordsEnd += length;
+    keep_tail(refresher, fd);
+    close(fd);
+
+    DictionaryWords *delta = dict_words_init();
+    free(delta->arena);
+    delta->arena = (char*) malloc(refresher->deltaSize + 1);
+    memcpy(delta->arena, refresher->deltaText, refresher->deltaSize);
+    delta->arenaSize = refresher->deltaSize;
+    delta->arenaMemsize = refresher->deltaSize + 1;
+    dict_words_split_arena(delta);
+    dict_words_normalize(delta);
+    dict_words_index_lengths(delta);
+
+    pthread_mutex_lock(&refresher->lock);
+    BaseWords *base = refresher->current->base;
+    base->references++;
+    pthread_mutex_unlock(&refresher->lock);
+    int baseSize = base->dict ? base->dict->size : base->coded->size;
+    swap_snapshot(refresher, base, delta);
+
+    return delta->size <= DELTA_MINIMUM ||
+            delta->size <= baseSize / DELTA_SHARE;
+}
+
+/**
+ * Checks whether the word list only grew, with what was read of it left
+ * as it was.
+ *
+ * Parameters:
+ *  refresher - the refresher
+ *  words - what the word list looks like now
+ *
+ * Returns true if the change is an append
+ * */
+static bool is_append(Refresher *refresher, FileState *words) {
+    if (!words->exists || words->device != refresher->words.device ||
+            words->inode != refresher->words.inode ||
+            words->size <= refresher->words.size) {
+        return false;
+    }
+
+    int fd = open(refresher->wordsFilename, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    char tail[REFRESH_TAIL_SIZE];
+    size_t got = read_at(fd, tail, refresher->tailSize,
+            refresher->wordsEnd - refresher->tailSize);
+    close(fd);
+    return got == (size_t) refresher->tailSize &&
+            !memcmp(tail, refresher->tail, got);
+}
+
+/**
+ * Works out what changed in the watched files and applies it.
+ *
+ * Parameters:
+ *  refresher - the refresher
+ *
+ * Returns nothing
+ * */
+static void apply_changes(Refresher *refresher) {
+    if (refresher->indexFilename) {
+        FileState index;
+        read_file_state(refresher->indexFilename, &index);
+        if (index.exists && !is_same_state(&index, &refresher->index)) {
+            reload_words(refresher);
+            return;
+        }
+    }
+
+    FileState words;
+    read_file_state(refresher->wordsFilename, &words);
+    if (!words.exists || is_same_state(&words, &refresher->words)) {
+        /* A word list being replaced is gone for a moment, the new one
+         * shows up as another change */
+        return;
+    }
+    if (!is_append(refresher, &words) || !append_words(refresher, &words)) {
+        reload_words(refresher);
+    }
+}
+
+/**
+ * Adds an inotify watch on the directory a file is in, which also sees
+ * the file being replaced by a rename.
+ *
+ * Parameters:
+ *  fd - the inotify instance
+ *  filename - the file to watch
+ *
+ * Returns nothing
+ * */
+static void watch_directory_of(int fd, char *filename) {
+    char directory[PATH_MAX];
+    snprintf(directory, sizeof(directory), "%s", filename);
+    inotify_add_watch(fd, dirname(directory), WATCH_EVENTS);
+}
+
+/**
+ * The watching thread: waits for the files to change and settle, then
+ * applies the changes.
+ *
+ * Parameters:
+ *  arg - the refresher
+ *
+ * Returns nothing, it never exits
+ * */
+static void *watch_files(void *arg) {
+    Refresher *refresher = (Refresher*) arg;
+    char events[4096];
+    struct pollfd waiting = {refresher->inotifyFd, POLLIN, 0};
+
+    while (read(refresher->inotifyFd, events, sizeof(events)) > 0) {
+        while (poll(&waiting, 1, REFRESH_SETTLE_MS) > 0 &&
+                read(refresher->inotifyFd, events, sizeof(events)) > 0) {
+        }
+        apply_changes(refresher);
+    }
+    return NULL;
+}
+
+Refresher *refresh_start(char *indexFilename, WordsLoader loader,
+        void *context) {
+    Refresher *refresher = (Refresher*) malloc(sizeof(Refresher));
+    memset(refresher, 0, sizeof(Refresher));
+    refresher->loader = loader;
+    refresher->context = context;
+    refresher->indexFilename = indexFilename;
+    pthread_mutex_init(&refresher->lock, NULL);
+    if (!reload_words(refresher)) {
+        free(refresher);
+        return NULL;
+    }
+
+    refresher->inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (refresher->inotifyFd == -1) {
+        return refresher;
+    }
+    watch_directory_of(refresher->inotifyFd, refresher->wordsFilename);
+    if (indexFilename) {
+        watch_directory_of(refresher->inotifyFd, indexFilename);
+    }
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, watch_files, refresher);
+    pthread_detach(tid);
+    return refresher;
+}
+
+Snapshot *refresh_acquire(Refresher *refresher) {
+    pthread_mutex_lock(&refresher->lock);
+    Snapshot *snapshot = refresher->current;
+    snapshot->references++;
+    pthread_mutex_unlock(&refresher->lock);
+    return snapshot;
+}
+
+void refresh_release(Refresher *refresher, Snapshot *snapshot) {
+    pthread_mutex_lock(&refresher->lock);
+    bool isUnused = --snapshot->references == 0;
+    bool isBaseUnused = isUnused && --snapshot->base->references == 0;
+    pthread_mutex_unlock(&refresher->lock);
+    if (!isUnused) {
+        return;
+    }
+
+    if (isBaseUnused) {
+        dict_words_free(snapshot->base->dict);
+        front_coded_free(snapshot->base->coded);
+        free(snapshot->base);
+    }
+    dict_words_free(snapshot->delta);
+    free(snapshot);
+}
@@ -0,0 +1,95 @@
+#ifndef REFRESH_H_
+#define REFRESH_H_
+
+#include <limits.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "frontcode.h"
+
+/* How long the files must be quiet after a change before it is applied */
+#define REFRESH_SETTLE_MS 100
+
+/* How many bytes before the end of what was read are kept, to tell an
+ * append from a rewrite that happens to make the file longer */
+#define REFRESH_TAIL_SIZE 64
+
+/* The words as loaded in full, shared by every snapshot until the next
+ * full load */
+typedef struct BaseWords BaseWords;
+
+/* The words as they were at one moment, kept alive while any query uses
+ * them.
+ *
+ * The words of a full load are in dict, or with -compact in coded, and
+ * the words appended to the file since are in delta, NULL if there are
+ * none. Their ids come after the loaded words in file order. generation
+ * goes up by one with every change the refresher applies. */
+typedef struct Snapshot Snapshot;
+struct Snapshot {
+    long generation;
+    DictionaryWords *dict;
+    FrontCoded *coded;
+    DictionaryWords *delta;
+    BaseWords *base;
+    int references;
+};
+
+/* What a full load produces */
+typedef struct {
+    DictionaryWords *dict;
+    FrontCoded *coded;
+    char wordsFilename[PATH_MAX]; /* the word list the words came from */
+} LoadedWords;
+
+/* Loads the words from scratch, as at start up, returning false if they
+ * can't be read */
+typedef bool (*WordsLoader)(LoadedWords *loaded, void *context);
+
+/* Keeps snapshots of a dictionary in step with its files */
+typedef struct Refresher Refresher;
+
+/**
+ * Loads the words and starts a thread that watches the word list, and
+ * the index file if they were loaded from one, with inotify. Words
+ * appended to the word list are added as a delta over the loaded words.
+ * Any other change, or a delta grown too large, reloads the words in
+ * full on the watching thread. Either way the new snapshot replaces the
+ * current one in a single swap, so queries never wait for a reload.
+ *
+ * Parameters:
+ *  indexFilename - the index file the words are loaded from, or NULL
+ *  loader - loads the words in full
+ *  context - passed to the loader untouched
+ *
+ * Returns the refresher, whose first snapshot is already loaded, or NULL
+ * if the words could not be loaded. Changes are not followed if inotify
+ * can't be used.
+ * */
+Refresher *refresh_start(char *indexFilename, WordsLoader loader,
+        void *context);
+
+/**
+ * Takes the current snapshot for a query. Safe to call from several
+ * threads.
+ *
+ * Parameters:
+ *  refresher - the refresher
+ *
+ * Returns the snapshot, give it back with refresh_release()
+ * */
+Snapshot *refresh_acquire(Refresher *refresher);
+
+/**
+ * Gives back a snapshot taken with refresh_acquire(), freeing it if it
+ * has been replaced and no other query uses it.
+ *
+ * Parameters:
+ *  refresher - the refresher
+ *  snapshot - the snapshot
+ *
+ * Returns nothing
+ * */
+void refresh_release(Refresher *refresher, Snapshot *snapshot);
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "scan.h"
+#include "utils.h"
+#include "stats.h"
+
+/* How many candidates a thread takes at a time */
+#define SCAN_CHUNK_SIZE 16384
+
+/* A scan shared by all its threads */
+typedef struct {
+    DictionaryWords *dict;
+    const int *candidates;
+    int count;
+    WordPredicate predicate;
+    void *query;
+    int limit;
+    bool isCounting;
+    int chunkCount;
+    int nextChunk; /* taken atomically */
+    int found; /* matches in the finished chunks, added atomically */
+    DictionaryWords **chunkMatches;
+} Scan;
+
+/**
+ * Tests a run of candidates, stopping early once the limit is reached as
+ * no later match could be kept
+ *
+ * Parameters:
+ *  scan - the scan the candidates belong to
+ *  first - the first candidate to test
+ *  end - one past the last candidate to test
+ *  matches - the match set the matching ids are added to, or only counted
+ *      in when the scan is counting
+ *
+ * Returns nothing
+ * */
+static void scan_range(Scan *scan, int first, int end,
+        DictionaryWords *matches) {
+    int i;
+    for (i = first; i < end && (scan->limit == 0 ||
+            matches->size < scan->limit); i++) {
+        int id = scan->candidates ? scan->candidates[i] : i;
+        if (scan->predicate(scan->dict, id, scan->query)) {
+            if (scan->isCounting) {
+                matches->size++;
+            } else {
+                dict_words_add_id(matches, id);
+            }
+        }
+    }
+    stats_add(COUNT_WORDS_SCANNED, i - first);
+}
+
+/**
+ * Tests the candidates of one chunk
+ *
+ * Parameters:
+ *  scan - the scan the chunk belongs to
+ *  chunk - the number of the chunk
+ *
+ * Returns nothing
+ * */
+static void scan_chunk(Scan *scan, int chunk) {
+    DictionaryWords *matches = dict_words_init_matches(scan->dict);
+    int first = chunk * SCAN_CHUNK_SIZE;
+    int end = first + SCAN_CHUNK_SIZE < scan->count ?
+            first + SCAN_CHUNK_SIZE : scan->count;
+
+    scan_range(scan, first, end, matches);
+    scan->chunkMatches[chunk] = matches;
+    __atomic_fetch_add(&scan->found, matches->size, __ATOMIC_RELAXED);
+}
+
+/**
+ * The body of a scanning thread: takes chunks until there are none left,
+ * or until the chunks taken so far hold enough matches
+ *
+ * Parameters:
+ *  scanInfo - the shared scan
+ *
+ * Returns NULL
+ * */
+static void *scan_thread(void *scanInfo) {
+    Scan *scan = (Scan*) scanInfo;
+    int chunk;
+    while ((scan->limit == 0 || __atomic_load_n(&scan->found,
+            __ATOMIC_RELAXED) < scan->limit) &&
+            (chunk = __atomic_fetch_add(&scan->nextChunk, 1,
+            __ATOMIC_RELAXED)) < scan->chunkCount) {
+        scan_chunk(scan, chunk);
+    }
+    return NULL;
+}
+
+DictionaryWords *scan_words(DictionaryWords *dict, const int *candidates,
+        int count, WordPredicate predicate, void *query, int threads,
+        const ScanBounds *bounds) {
+    Scan scan;
+    scan.dict = dict;
+    scan.candidates = candidates;
+    scan.count = count;
+    scan.predicate = predicate;
+    scan.query = query;
+    scan.limit = bounds ? bounds->limit : 0;
+    scan.isCounting = bounds && bounds->isCounting;
+    scan.chunkCount = (count + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
+    scan.nextChunk = 0;
+    scan.found = 0;
+
+    if (threads > scan.chunkCount) {
+        threads = scan.chunkCount;
+    }
+    if (threads <= 1) {
+        /* No need for chunks */
+        DictionaryWords *matches = dict_words_init_matches(dict);
+        scan_range(&scan, 0, count, matches);
+        return matches;
+    }
+
+    /* Chunks never taken are left NULL */
+    scan.chunkMatches = (DictionaryWords**) calloc(scan.chunkCount,
+            sizeof(DictionaryWords*));
+    pthread_t tids[MAX_SCAN_THREADS];
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, scan_thread, &scan);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    int total = 0;
+    for (int chunk = 0; chunk < scan.chunkCount &&
+            scan.chunkMatches[chunk]; chunk++) {
+        total += scan.chunkMatches[chunk]->size;
+    }
+    if (scan.limit && total > scan.limit) {
+        total = scan.limit;
+    }
+    DictionaryWords *matches = dict_words_init_matches(dict);
+    if (scan.isCounting) {
+        matches->size = total;
+    } else {
+        dict_words_reserve(matches, total);
+    }
+    for (int chunk = 0; chunk < scan.chunkCount &&
+            scan.chunkMatches[chunk]; chunk++) {
+        DictionaryWords *part = scan.chunkMatches[chunk];
+        int kept = part->size < total - matches->size ?
+                part->size : total - matches->size;
+        if (!scan.isCounting && kept) {
+            memcpy(matches->ids + matches->size, part->ids,
+                    kept * sizeof(int));
+            matches->size += kept;
+        }
+        dict_words_free(part);
+    }
+    free(scan.chunkMatches);
+
+    return matches;
+}
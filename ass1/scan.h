@@ -0,0 +1,46 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* The most threads a scan can be split over */
+#define MAX_SCAN_THREADS 256
+
+/* Decides whether one word of a scan matches */
+typedef bool (*WordPredicate)(DictionaryWords *dict, int id, void *query);
+
+/* How much of a scan's result is wanted */
+typedef struct {
+    int limit; /* stop once this many matches are found, 0 for all */
+    bool isCounting; /* only count the matches, keeping no ids */
+} ScanBounds;
+
+/**
+ * Tests every candidate word against a predicate, splitting the candidates
+ * into chunks that the threads take in turn. Each chunk keeps its own
+ * matches and the chunks are joined in order, so the result is the same
+ * whatever the number of threads.
+ *
+ * With a limit no more chunks are taken once the chunks taken so far hold
+ * enough matches. The chunks are taken in order, so the first matches in
+ * candidate order are still the ones kept.
+ *
+ * Parameters:
+ *  dict - the dictionary being searched
+ *  candidates - the ids to test in order, or NULL for ids 0 to count - 1
+ *  count - the number of candidates
+ *  predicate - the test for a single word
+ *  query - passed to the predicate untouched
+ *  threads - how many threads to use, 1 scans on the calling thread
+ *  bounds - the limit and whether to count, NULL for every match
+ *
+ * Returns the match set, in the order of the candidates. When counting
+ * only its size is set, it holds no ids.
+ * */
+DictionaryWords *scan_words(DictionaryWords *dict, const int *candidates,
+        int count, WordPredicate predicate, void *query, int threads,
+        const ScanBounds *bounds);
+
+#endif
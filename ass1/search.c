@@ -3,36 +3,100 @@
 #include <getopt.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "utils.h"
 #include "common.h"
+#include "letterindex.h"
+#include "dawg.h"
+#include "fmindex.h"
+#include "indexfile.h"
+#include "matcher.h"
+#include "scan.h"
+#include "serve.h"
+#include "batch.h"
+#include "collate.h"
+#include "stream.h"
+#include "output.h"
+#include "stats.h"
+#include "frontcode.h"
+#include "refresh.h"
+#include "merge.h"
+#include "cache.h"
 
 /* The default file to read words from when 
  * user hasn't specified a file name */
 #define DEFAULT_DICTIONARY_FILENAME "/usr/share/dict/words"
 
-/* We dynammically resize the word read, we allocate in chunks for speed*/
-#define READ_MEM_ALLOCATION_CHUNK 32
-
 /* Enum representing program search type */
 typedef enum {
-    SEARCH_PREFIX, SEARCH_EXACT, SEARCH_ANYWHERE, BAD_OPTION, SORT_OPTION
+    SEARCH_PREFIX, SEARCH_EXACT, SEARCH_ANYWHERE, BAD_OPTION, SORT_OPTION,
+    BACKEND_OPTION, THREADS_OPTION, BUILD_INDEX_OPTION,
+    SERVE_OPTION, PATTERNS_OPTION, STREAM_OPTION, STATS_OPTION,
+    COMPACT_OPTION, COUNT_OPTION, LIMIT_OPTION
 } OptionType;
 
+/* Enum representing the engine that answers a search */
+typedef enum {
+    BACKEND_SCAN, BACKEND_BITSET, BACKEND_DAWG, BACKEND_FM, BAD_BACKEND
+} BackendType;
+
 /* A structure that represents the program options */
 typedef struct {
     OptionType searchType;
     bool sort;
     char *pattern;
-    char *dictionaryFilename;
+    char *dictionaryFilename; /* the first of the dictionary files */
+    char **dictionaryFilenames;
+    int dictionaryCount;
     bool searchExactFound; 
     bool searchPrefixFound;
     bool searchAnywhereFound;
     bool isSortSpecified;
+    BackendType backend;
+    bool isBackendSpecified;
+    int threads;
+    bool isThreadsSpecified;
+    char *indexFilename; /* the index file to build, if any */
+    char *socketPath; /* where to serve queries from, if anywhere */
+    char *patternsFilename; /* the file of patterns to batch, if any */
+    bool isStreamSpecified;
+    bool isStatsSpecified;
+    bool isCompactSpecified;
+    bool isCountSpecified;
+    int limit; /* how many matches to print at most, 0 for all */
+    bool isLimitSpecified;
 } Options;
 
+/* What the query handler of -serve searches with: the options, the
+ * snapshots of the dictionary, kept up to date as its file changes, and
+ * the results of recent queries */
+typedef struct {
+    Options *options;
+    Refresher *refresher;
+    ResultCache *cache;
+} ServeContext;
+
+/* One of several dictionary files, loaded on its own thread */
+typedef struct {
+    char *filename;
+    DictionaryWords *dict;
+} DictionaryLoad;
+
+/* What a scan over the dictionary tests each word against */
+typedef struct {
+    CompiledPattern compiled;
+    bool matchAll;
+    bool isCountingRejected; /* words failing the cheap tests are counted */
+} ScanQuery;
+
 /**
  * Prints the program usage and exits with a specified error code.
  *
@@ -44,7 +108,17 @@ typedef struct {
  */
 void print_usage(FILE *stream, int exitCode) {
     fprintf(stream, "Usage: search [-exact|-prefix|-anywhere]"
-            " [-sort] pattern [filename]\n");
+            " [-sort] [-backend scan|bitset|dawg|fm] [-threads N]"
+            " [-compact] [-count] [-limit N] [-stats] pattern"
+            " [filename ...]\n"
+            "       search -stream [-exact|-prefix|-anywhere] [-threads N]"
+            " [-stats] pattern [filename]\n"
+            "       search -build-index index [-backend bitset|dawg|fm]"
+            " [-stats] [filename]\n"
+            "       search -serve socket [-backend scan|bitset|dawg|fm]"
+            " [-threads N] [-compact] [filename]\n"
+            "       search -patterns file [-exact|-prefix|-anywhere]"
+            " [-sort] [-stats] [filename ...]\n");
     exit(exitCode);
 }
 
@@ -85,11 +159,143 @@ OptionType get_option_type(char *option) {
         return SEARCH_ANYWHERE;
     } else if (!strcmp(option, "-sort")) {
         return SORT_OPTION; 
+    } else if (!strcmp(option, "-backend")) {
+        return BACKEND_OPTION;
+    } else if (!strcmp(option, "-threads")) {
+        return THREADS_OPTION;
+    } else if (!strcmp(option, "-build-index")) {
+        return BUILD_INDEX_OPTION;
+    } else if (!strcmp(option, "-serve")) {
+        return SERVE_OPTION;
+    } else if (!strcmp(option, "-patterns")) {
+        return PATTERNS_OPTION;
+    } else if (!strcmp(option, "-stream")) {
+        return STREAM_OPTION;
+    } else if (!strcmp(option, "-stats")) {
+        return STATS_OPTION;
+    } else if (!strcmp(option, "-compact")) {
+        return COMPACT_OPTION;
+    } else if (!strcmp(option, "-count")) {
+        return COUNT_OPTION;
+    } else if (!strcmp(option, "-limit")) {
+        return LIMIT_OPTION;
     } else {
         return BAD_OPTION;
     }
 }
 
+/**
+ * Maps the name given to -backend to its type.
+ *
+ * Parameters:
+ *  name - The backend name from the command line
+ *
+ *  Returns a BackendType enum, BAD_BACKEND if the name is unknown
+ *
+ * */
+BackendType get_backend_type(char *name) {
+
+    if (!strcmp(name, "scan")) {
+        return BACKEND_SCAN;
+    } else if (!strcmp(name, "bitset")) {
+        return BACKEND_BITSET;
+    } else if (!strcmp(name, "dawg")) {
+        return BACKEND_DAWG;
+    } else if (!strcmp(name, "fm")) {
+        return BACKEND_FM;
+    } else {
+        return BAD_BACKEND;
+    }
+}
+
+/**
+ * Checks whether an option expects a value in the next argument.
+ *
+ * Parameters:
+ *  option - The command line argument to check
+ *
+ *  Returns true if the next argument belongs to the option
+ *
+ * */
+bool option_takes_value(char *option) {
+    OptionType type = get_option_type(option);
+    return type == BACKEND_OPTION || type == THREADS_OPTION ||
+            type == BUILD_INDEX_OPTION || type == SERVE_OPTION ||
+            type == PATTERNS_OPTION || type == LIMIT_OPTION;
+}
+
+/**
+ * Processes an option that takes a value, exiting with the usage
+ * message if the option is repeated or the value is invalid.
+ *
+ * Parameters:
+ *  option - the option argument
+ *  value - the argument following the option
+ *  options - the programs options structure.
+ *
+ *  Returns nothing
+ */
+void process_value_argument(char *option, char *value, Options *options) {
+    switch (get_option_type(option)) {
+        case BACKEND_OPTION:
+            if (options->isBackendSpecified) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            options->isBackendSpecified = true;
+            options->backend = get_backend_type(value);
+            if (options->backend == BAD_BACKEND) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            break;
+        case THREADS_OPTION:
+            if (options->isThreadsSpecified) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            options->isThreadsSpecified = true;
+            char *end;
+            long threads = strtol(value, &end, 10);
+            if (*value == 0 || *end != 0 || threads < 1 ||
+                    threads > MAX_SCAN_THREADS) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            options->threads = threads;
+            break;
+        case LIMIT_OPTION:
+            if (options->isLimitSpecified) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            options->isLimitSpecified = true;
+            char *limitEnd;
+            long limit = strtol(value, &limitEnd, 10);
+            if (*value == 0 || *limitEnd != 0 || limit < 1 ||
+                    limit > INT_MAX) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            options->limit = limit;
+            break;
+        case BUILD_INDEX_OPTION:
+            if (options->indexFilename) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            options->indexFilename = value;
+            break;
+        case SERVE_OPTION:
+            if (options->socketPath) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            options->socketPath = value;
+            break;
+        case PATTERNS_OPTION:
+            if (options->patternsFilename) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            options->patternsFilename = value;
+            break;
+        default:
+            print_usage(stderr, EXIT_FAILURE);
+    }
+}
+
 /**
  *
  * Processes the command-line argument and performs some validation.
@@ -133,6 +339,34 @@ void process_argument(char *argument, Options *options) {
                 print_usage(stderr, EXIT_FAILURE);
             }
 
+            break;
+        case STREAM_OPTION:
+            if (!options->isStreamSpecified) {
+                options->isStreamSpecified = true;
+            } else {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            break;
+        case STATS_OPTION:
+            if (!options->isStatsSpecified) {
+                options->isStatsSpecified = true;
+            } else {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            break;
+        case COMPACT_OPTION:
+            if (!options->isCompactSpecified) {
+                options->isCompactSpecified = true;
+            } else {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            break;
+        case COUNT_OPTION:
+            if (!options->isCountSpecified) {
+                options->isCountSpecified = true;
+            } else {
+                print_usage(stderr, EXIT_FAILURE);
+            }
             break;
         default:
             print_usage(stderr, EXIT_FAILURE);
@@ -142,19 +376,20 @@ void process_argument(char *argument, Options *options) {
 
 /**
  * Finally build the command options, to later be queried.
- * The patternIndex and filenameIndex tell us where the pattern and
- * filename are in argv.
+ * The patternIndex and filenameIndexes tell us where the pattern and
+ * filenames are in argv.
  *
  * Parameters:
  *  patternIndex - the index of the pattern in argv
- *  filenameIndex - the index of the filename in argv
+ *  filenameIndexes - the indexes of the filenames in argv
+ *  filenameCount - how many filenames there are
  *  argv - the list of arguments passed to the program
  *  options - the programs options structure
  *
  *  Returns none
  */
-void build_options(int patternIndex, int filenameIndex,
-        char **argv, Options *options) {
+void build_options(int patternIndex, int *filenameIndexes,
+        int filenameCount, char **argv, Options *options) {
     if (options->searchExactFound &&
             !(options->searchPrefixFound || options->searchAnywhereFound)) {
         options->searchType = SEARCH_EXACT;
@@ -171,15 +406,25 @@ void build_options(int patternIndex, int filenameIndex,
 
     options->sort = options->isSortSpecified;
 
+    if (!options->isThreadsSpecified) {
+        options->threads = 1;
+        if (options->socketPath) {
+            options->threads = sysconf(_SC_NPROCESSORS_ONLN);
+        }
+    }
+
     if (patternIndex != -1) {
         options->pattern = argv[patternIndex];
     } 
 
-    if (filenameIndex != -1) {
-        options->dictionaryFilename = argv[filenameIndex];
-    } else {
-        options->dictionaryFilename = DEFAULT_DICTIONARY_FILENAME;
+    options->dictionaryCount = filenameCount ? filenameCount : 1;
+    options->dictionaryFilenames = (char**) malloc(options->dictionaryCount *
+            sizeof(char*));
+    options->dictionaryFilenames[0] = DEFAULT_DICTIONARY_FILENAME;
+    for (int i = 0; i < filenameCount; i++) {
+        options->dictionaryFilenames[i] = argv[filenameIndexes[i]];
     }
+    options->dictionaryFilename = options->dictionaryFilenames[0];
 }
 
 /**
@@ -199,37 +444,60 @@ Options *parse_options(int argc, char **argv) {
 
     Options *options = (Options*) malloc(sizeof(Options)); 
     memset(options, 0, sizeof(Options));
-    int patternIndex, filenameIndex;
-    patternIndex = filenameIndex = -1;
+    /* The pattern, if there is one, then the filenames */
+    int *nonOptionIndexes = (int*) malloc(argc * sizeof(int));
     int nonOptionArgumentsFound = 0;
 
     /* Process command-line options*/
     for (int i = 1; i < argc; i++) {
 
         /* Is argument an option */
-        if (is_argument_an_option(argv[i])) {
+        if (is_argument_an_option(argv[i]) && option_takes_value(argv[i])) {
+            if (i + 1 == argc) {
+                print_usage(stderr, EXIT_FAILURE);
+            }
+            process_value_argument(argv[i], argv[i + 1], options);
+            i++;
+        } else if (is_argument_an_option(argv[i])) {
             process_argument(argv[i], options);
         } else {
-            nonOptionArgumentsFound++;
-
-            /*This is either a pattern or a file */
-            if (patternIndex == -1) {
-                patternIndex = i;
-            }
-
-            /* After a pattern we expect a file*/
-            if (patternIndex != -1 && 
-                    filenameIndex == -1 && patternIndex != i) {
-                filenameIndex = i;
-            }
+            /* This is either a pattern or a file */
+            nonOptionIndexes[nonOptionArgumentsFound++] = i;
         }
     }
 
-    if (nonOptionArgumentsFound > 2 || patternIndex == -1) {
+    int modesFound = (options->indexFilename != NULL) +
+            (options->socketPath != NULL) +
+            (options->patternsFilename != NULL);
+    if (modesFound > 1 || (options->isStreamSpecified &&
+            (modesFound > 0 || options->isSortSpecified)) ||
+            (options->socketPath && options->isStatsSpecified) ||
+            (options->isCompactSpecified && (options->indexFilename ||
+            options->patternsFilename || options->isStreamSpecified ||
+            (options->isBackendSpecified &&
+            options->backend != BACKEND_SCAN))) ||
+            ((options->isCountSpecified || options->isLimitSpecified) &&
+            (modesFound > 0 || options->isStreamSpecified))) {
+        /* Streamed results can't be sorted without holding them all, a
+         * server never finishes to report its stats, front coded words
+         * can only be scanned and counts and limits are for one search */
+        print_usage(stderr, EXIT_FAILURE);
+    }
+
+    /* Building an index, serving and batches take no pattern, just the
+     * word lists. An index and a server follow a single word list, and
+     * a stream reads just one. */
+    bool hasPattern = modesFound == 0;
+    int filenameCount = nonOptionArgumentsFound - hasPattern;
+    if ((hasPattern && nonOptionArgumentsFound == 0) ||
+            (filenameCount > 1 && (options->indexFilename ||
+            options->socketPath || options->isStreamSpecified))) {
         print_usage(stderr, EXIT_FAILURE);
     }
 
-    build_options(patternIndex, filenameIndex, argv, options);
+    build_options(hasPattern ? nonOptionIndexes[0] : -1,
+            nonOptionIndexes + hasPattern, filenameCount, argv, options);
+    free(nonOptionIndexes);
 
     return options;
 }
@@ -291,197 +559,173 @@ bool is_match_all_prefix(char *pattern) {
 }
 
 /**
- *  Checks whether a word is all alphabetic
+ *
+ *  This function is responsible for handling prefix matches
  *
  *  Parameters:
- *      word - The word to check if it's all alphabetic
+ *      word - The folded word to check if it matches a prefix
+ *      wordInfo - The length and alphabetic flag of the word
+ *      compiled - The compiled pattern containing the prefix
+ *      readableBytes - How many bytes can be read from the word's start
  *
- *  Returns true if the word is alphabetic false otherwise
- * */
-bool is_all_alphabetic_word(char *word) {
-    for (int i = 0; i < strlen(word); i++) {
-        if (!isalpha(word[i])) {
-            return false;
-        }
+ *  Returns true if the pattern matches, false otherwise 
+ **/
+bool is_word_a_prefix_match(char *word, uint32_t wordInfo,
+        CompiledPattern *compiled, size_t readableBytes) {
+
+    if ((wordInfo & WORD_ALPHA_BIT) &&
+            (int) (wordInfo & WORD_LENGTH_MASK) >= compiled->length) {
+        return compiled_pattern_match(compiled, word, readableBytes);
     }
 
-    return true;
+    return false;
 }
 
 /**
+ * Tests one word of a prefix scan
  *
- *  This function is responsible for handling prefix matches
+ * Parameters:
+ *  dict - The dictionary being searched
+ *  id - The id of the word to test
+ *  query - The ScanQuery holding the pattern
  *
- *  Parameters:
- *      word - The word to check if it matches a prefix
- *      pattern - The pattern containing the prefix
+ *  Returns true if the word matches the prefix
  *
- *  Returns true if the pattern matches, false otherwise 
- **/
-bool is_word_a_prefix_match(char *word, char *pattern) {
-
-    if (strlen(word) >= strlen(pattern) && is_all_alphabetic_word(word)) {
-
-        if (is_match_all_prefix(pattern)) {
-            return true;
-        }
-
-        for (int i = 0; i < strlen(pattern); i++) {
-            if (!isalpha(word[i])) {
-                return false;    
-            }
-
-            if (pattern[i] == '?') {
-                continue;
-            }
-
-            if (isalpha(word[i]) && tolower(pattern[i]) == tolower(word[i])) {
-                continue;
-            } else {
-                return false;
-            }          
+ * */
+bool prefix_scan_predicate(DictionaryWords *dict, int id, void *query) {
+    ScanQuery *scanQuery = (ScanQuery*) query;
+    uint32_t need = scanQuery->compiled.needLetters;
+
+    if (scanQuery->matchAll) {
+        return (dict->wordInfo[id] & WORD_ALPHA_BIT) &&
+                (int) (dict->wordInfo[id] & WORD_LENGTH_MASK) >=
+                scanQuery->compiled.length;
+    }
+    if ((dict->letterSigs[id] & need) != need ||
+            !(dict->wordInfo[id] & WORD_ALPHA_BIT)) {
+        if (scanQuery->isCountingRejected) {
+            stats_add(COUNT_WORDS_REJECTED, 1);
         }
-
-        return true;
+        return false;
     }
-
-    return false;
+    return is_word_a_prefix_match(dict->folded + dict->offsets[id],
+            dict->wordInfo[id], &scanQuery->compiled,
+            dict->arenaSize - dict->offsets[id]);
 }
 
 /**
- * Goes through the dictionary to check all words that match the prefix
+ * Goes through the dictionary to check all words that match the prefix.
+ * Only the length groups at least as long as the pattern are visited.
+ * With a limit the words are visited in dictionary order instead, so the
+ * scan can stop at the first matches.
  *
  * Parameters:
  *  pattern - The pattern that contains the prefix
  *  dict - The dictionary containing all the words to check against
+ *  threads - The number of threads to scan with
+ *  bounds - The limit and whether to only count the matches
  *
  *  Returns a dictionary containing the list that contains the matched words 
  *
  * */
 DictionaryWords *pattern_match_words_prefix(char *pattern, 
-        DictionaryWords *dict) {
-    DictionaryWords *matchesDict = dict_words_init();
-
-    for (int i = 0; i < dict->size; i++) {
-        if (is_word_a_prefix_match(dict->words[i], pattern)) {
-            dict_words_add(matchesDict, dict->words[i]); 
-        }
+        DictionaryWords *dict, int threads, const ScanBounds *bounds) {
+    ScanQuery query;
+    compile_pattern(&query.compiled, pattern);
+    query.matchAll = is_match_all_prefix(pattern);
+    query.isCountingRejected = stats_is_enabled();
+    int patternLength = query.compiled.length;
+
+    if (patternLength > dict->maxWordLength) {
+        stats_add(COUNT_WORDS_REJECTED, dict->size);
+        return dict_words_init_matches(dict);
     }
 
-    return matchesDict;
-}
-
-/**
- * Check whether two letters match. Will return true if letter is being
- * compared with '?'
- *  
- *  Parameters:
- *   patternLetter   - the letter of the pattern to compare
- *   wordLetter      - the letter in the word to compare 
- *   
- * Returns true if they match or is a comparison again '?', false otherwise
- */
-bool is_letter_a_match(char patternLetter, char wordLetter) {
-
-    if (patternLetter == '?') {
-        return true;
+    if (bounds->limit) {
+        return scan_words(dict, NULL, dict->size, prefix_scan_predicate,
+                &query, threads, bounds);
     }
 
-    if (isalpha(wordLetter) && tolower(patternLetter) == tolower(wordLetter)) {
-        return true;
-
-    }
-
-    return false;
-}
-
-/**
- * Find the next beginning of the word that matches
- * the first letter of the pattern.
- *
- * Parameters:
- *  patern - The pattern
- *  word - The word we will search for the beginning of the pattern
- *  lastIndex - Where we will start looking for the start in the word
- *
- * Returns the index to where the word starts, -1 if none can be found
- */
-int get_start_of_next_match_index(char *pattern, char *word, int lastIndex) {
-
-    bool lastLetterMatched = false;
+    /* The long enough groups are next to each other in lengthIds */
+    int first = dict->lengthStarts[patternLength];
+    stats_add(COUNT_WORDS_REJECTED, first);
+    DictionaryWords *matchesDict = scan_words(dict, dict->lengthIds + first,
+            dict->size - first, prefix_scan_predicate, &query, threads,
+            bounds);
 
-    /*Seek for first letter that matches*/
-    int i = lastIndex;
-    while (i < strlen(word)) {
-        lastLetterMatched = is_letter_a_match(pattern[0], word[i]); 
-        if (lastLetterMatched && tolower(pattern[0]) !=  tolower(word[i+1])) {
-            break;
-        }
-        i++;
+    /* Each group is in dictionary order but the groups need merging */
+    if (!bounds->isCounting && matchesDict->size > 1) {
+        qsort(matchesDict->ids, matchesDict->size, sizeof(int), compare_ids);
     }
 
-    return lastLetterMatched ? i : -1;
+    return matchesDict;
 }
 
 /**
  * This is the algorithm to try and match parts of a word 
- * with the anywhere search strategy. It First tried
- * to locate an index in the word where the first character matches
- * the first character of the pattern. It will keep doing this until
- * all the places starting with the first letter of the pattern are exhausted.
+ * with the anywhere search strategy. Every place the pattern fits in the
+ * word is tried against the compiled plan, which tests the pattern's
+ * rarest letter first, so overlapping matches are found too.
+ *
+ * Patterns short enough for a shift-or search are instead found in one
+ * pass over the word by compiled_pattern_find.
  *
  * Parameter:
- *  word - The word to search for the pattern
- *  pattern - The pattern to search the word by
+ *  word - The folded word to search for the pattern
+ *  wordInfo - The length and alphabetic flag of the word
+ *  compiled - The compiled pattern to search the word by
  *
  *
  */
-bool is_word_an_anywhere_match(char *word, char *pattern) {
+bool is_word_an_anywhere_match(char *word, uint32_t wordInfo,
+        CompiledPattern *compiled) {
+    int patternLength = compiled->length;
+    int wordLength = wordInfo & WORD_LENGTH_MASK;
 
     /* if word length is less than the pattern or word is not alphabetic,
      * no match is found */
-    if (strlen(word) < strlen(pattern) || !is_all_alphabetic_word(word)) {
+    if (wordLength < patternLength || !(wordInfo & WORD_ALPHA_BIT)) {
         return false;
     }
+    if (compiled->hasShiftMasks) {
+        return compiled_pattern_find(compiled, word, wordLength);
+    }
 
-    int startOfMatchIndex = 0;
-    int matchCount = 0;   
-    while ((startOfMatchIndex = get_start_of_next_match_index(pattern,
-            word, startOfMatchIndex)) != -1) {
-
-        bool lastLetterMatched = startOfMatchIndex != -1;
-        matchCount = 0;
-        int i = startOfMatchIndex;
-        if (startOfMatchIndex != -1) {
-            int j = 0;
-            do {
-                bool isNewLetterAMatch = is_letter_a_match(pattern[j], 
-                        word[i]);
-                if (isNewLetterAMatch) {
-                    matchCount++;
-                }
-                if (lastLetterMatched && !isNewLetterAMatch) {
-                    lastLetterMatched = false;
-                    break;
-                }
-                lastLetterMatched = isNewLetterAMatch;
-
-                j++;
-                i++;
-            } while (i < strlen(word) && j < strlen(pattern));
-
-            startOfMatchIndex = i;
-
-            if (matchCount == strlen(pattern)) {
-                break;
-            }
-
+    for (int start = 0; start + patternLength <= wordLength; start++) {
+        if (compiled_pattern_match(compiled, word + start,
+                wordLength - start)) {
+            return true;
         }
-
     }
 
+    return false;
+}
 
-    return matchCount == strlen(pattern) ? true : false;
+/**
+ * Tests one word of an anywhere scan
+ *
+ * Parameters:
+ *  dict - The dictionary being searched
+ *  id - The id of the word to test
+ *  query - The ScanQuery holding the pattern
+ *
+ *  Returns true if the pattern is found in the word
+ *
+ * */
+bool anywhere_scan_predicate(DictionaryWords *dict, int id, void *query) {
+    ScanQuery *scanQuery = (ScanQuery*) query;
+    uint32_t need = scanQuery->compiled.needLetters;
+
+    /* Most words lack one of the pattern's letters, which is one test */
+    if ((dict->letterSigs[id] & need) != need ||
+            !(dict->wordInfo[id] & WORD_ALPHA_BIT)) {
+        if (scanQuery->isCountingRejected) {
+            stats_add(COUNT_WORDS_REJECTED, 1);
+        }
+        return false;
+    }
+    return is_word_an_anywhere_match(dict->folded + dict->offsets[id],
+            dict->wordInfo[id], &scanQuery->compiled);
 }
 
 /**
@@ -491,20 +735,19 @@ bool is_word_an_anywhere_match(char *word, char *pattern) {
  * Parameters:
  *  pattern - The pattern to look for
  *  dict - The dictionary containing the words
+ *  threads - The number of threads to scan with
+ *  bounds - The limit and whether to only count the matches
  *
  *  Returns a dictionary with all the matched words, which may be blank
  */
 DictionaryWords *pattern_match_words_anywhere(char *pattern,
-        DictionaryWords *dict) {
-    DictionaryWords *matchesDict = dict_words_init();
-
-    for (int i = 0; i < dict->size; i++) {
-        if (is_word_an_anywhere_match(dict->words[i], pattern)) {
-            dict_words_add(matchesDict, dict->words[i]); 
-        }
-    }
+        DictionaryWords *dict, int threads, const ScanBounds *bounds) {
+    ScanQuery query;
+    compile_pattern(&query.compiled, pattern);
+    query.isCountingRejected = stats_is_enabled();
 
-    return matchesDict;
+    return scan_words(dict, NULL, dict->size, anywhere_scan_predicate,
+            &query, threads, bounds);
 }
 
 /**
@@ -512,62 +755,105 @@ DictionaryWords *pattern_match_words_anywhere(char *pattern,
  *  Checks if the word matches an exact pattern search type
  *
  *  Parameters:
- *      word - the word to check against the patter
- *      pattern - the pattern to do an exact match with
+ *      word - the folded word to check against the patter
+ *      wordInfo - the length and alphabetic flag of the word
+ *      compiled - the compiled pattern to do an exact match with
+ *      readableBytes - how many bytes can be read from the word's start
  *
  *  Returns true if the word matches, false otherwise
  *  */
-bool is_word_an_exact_match(char *word, char *pattern) {
+bool is_word_an_exact_match(char *word, uint32_t wordInfo,
+        CompiledPattern *compiled, size_t readableBytes) {
 
-    if (strlen(word) != strlen(pattern)) {
+    /* The alphabetic bit makes any word that isn't all letters unequal */
+    if (wordInfo != ((uint32_t) compiled->length | WORD_ALPHA_BIT)) {
         return false;
     }
 
-    for (int i = 0; i < strlen(word); i++) {
-        if (!isalpha(word[i])) {
-            return false;    
-        }
-        if (pattern[i] == '?') {
-            continue;
-        }
+    return compiled_pattern_match(compiled, word, readableBytes);
+}
 
-        if (isalpha(word[i]) && tolower(pattern[i]) == tolower(word[i])) {
-            continue;
-        } else {
-            return false;
-        }
-    }
+/**
+ * Tests one word of an exact scan
+ *
+ * Parameters:
+ *  dict - The dictionary being searched
+ *  id - The id of the word to test
+ *  query - The ScanQuery holding the pattern
+ *
+ *  Returns true if the word matches exactly
+ *
+ * */
+bool exact_scan_predicate(DictionaryWords *dict, int id, void *query) {
+    ScanQuery *scanQuery = (ScanQuery*) query;
 
-    return true;
+    return is_word_an_exact_match(dict->folded + dict->offsets[id],
+            dict->wordInfo[id], &scanQuery->compiled,
+            dict->arenaSize - dict->offsets[id]);
 }
 
 /**
  *  Searches for words that match using the exact search type.
  *  It builds a dynamic list with all the words and returns it.
+ *  Only the words with the same length as the pattern are visited.
  *
  *  Parameters:
  *      pattern - the pattern to match the words against
  *      dict - the dictionary of words to search 
+ *      threads - the number of threads to scan with
+ *      bounds - the limit and whether to only count the matches
  *
  *  Returns a dictionary containing the list of words, 
  *  might be empty, check dict->size. 
  *  
  * */
 DictionaryWords *pattern_match_words_exact(char *pattern,
-        DictionaryWords *dict) {
-    DictionaryWords *matchesDict = dict_words_init();
+        DictionaryWords *dict, int threads, const ScanBounds *bounds) {
+    ScanQuery query;
+    compile_pattern(&query.compiled, pattern);
+    int patternLength = query.compiled.length;
+
+    /* We only want words that the same length */
+    if (patternLength > dict->maxWordLength) {
+        stats_add(COUNT_WORDS_REJECTED, dict->size);
+        return dict_words_init_matches(dict);
+    }
 
-    for (int i = 0; i < dict->size; i++) {
+    int first = dict->lengthStarts[patternLength];
+    stats_add(COUNT_WORDS_REJECTED, dict->size -
+            (dict->lengthStarts[patternLength + 1] - first));
+    return scan_words(dict, dict->lengthIds + first,
+            dict->lengthStarts[patternLength + 1] - first,
+            exact_scan_predicate, &query, threads, bounds);
+}
 
-        /* We only want words that the same length */
-        if (strlen(dict->words[i]) == strlen(pattern)) {
-            if (is_word_an_exact_match(dict->words[i], pattern)) {
-                dict_words_add(matchesDict, dict->words[i]);        
-            }
+/**
+ *
+ *  Reads all the words from a stream into the arena. This is the slow
+ *  path used when the dictionary can't be memory mapped (e.g. a pipe).
+ *
+ *  Paramaters:
+ *   file - The stream to read the words from
+ *
+ *   Returns the dictionary words
+ *
+ * */
+DictionaryWords *read_words_from_stream(FILE *file) {
+
+    DictionaryWords *dict = dict_words_init();
+
+    size_t bytesRead;
+    while ((bytesRead = fread(dict->arena + dict->arenaSize, 1,
+            dict->arenaMemsize - dict->arenaSize, file)) > 0) {
+        dict->arenaSize += bytesRead;
+        if (dict->arenaSize == dict->arenaMemsize) {
+            dict->arenaMemsize *= 2;
+            dict->arena = (char*) realloc(dict->arena, dict->arenaMemsize);
         }
     }
+    dict_words_split_arena(dict);
 
-    return matchesDict;
+    return dict;
 }
 
 /**
@@ -575,6 +861,9 @@ DictionaryWords *pattern_match_words_exact(char *pattern,
  *  Reads all the words from a file and puts them into the structure.
  *  The structure has the words and how many there is for easy iteration.
  *  
+ *  Regular files are memory mapped and used as the arena directly,
+ *  so no memory is allocated per word.
+ *
  *  Paramaters:
  *   filename - The file to read the words from
  *
@@ -583,25 +872,847 @@ DictionaryWords *pattern_match_words_exact(char *pattern,
  * */
 DictionaryWords *read_words_from_file(char *filename) {
 
-    FILE *file = fopen(filename, "r");
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+    DictionaryWords *dict;
+    char *mapping = MAP_FAILED;
 
-    DictionaryWords *dict = dict_words_init();
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+        info.st_size = -1;
+    } else if (info.st_size > 0) {
+        /* Only read, so the pages stay shared with the page cache */
+        mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
 
-    char *word;
-    while ((word = read_line(file, READ_MEM_ALLOCATION_CHUNK))) {
-        dict_words_add(dict, word);
+    if (mapping != MAP_FAILED) {
+        close(fd);
+        madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+        dict = dict_words_init();
+        free(dict->arena);
+        dict->arena = mapping;
+        dict->arenaSize = info.st_size;
+        dict->arenaMemsize = info.st_size;
+        dict->isArenaMapped = true;
+        dict_words_split_arena(dict);
+    } else if (info.st_size == 0) {
+        close(fd);
+        dict = dict_words_init();
+    } else {
+        FILE *file = fdopen(fd, "r");
+        dict = read_words_from_stream(file);
+        fclose(file);
     }
+
+    stats_add(COUNT_BYTES_READ, dict->arenaSize);
+    dict_words_normalize(dict);
+    dict_words_index_lengths(dict);
     return dict;
 }
 
+/**
+ *
+ *  Runs the search the options ask for with the chosen backend. Modes a
+ *  backend can't answer, and backends whose index isn't built, fall back
+ *  to scanning the dictionary.
+ *
+ *  With -limit only the first matches are kept, and a scan stops once it
+ *  has them, unless they are to be sorted. With -count a scan only counts
+ *  the matches and the match set holds no ids, only its size.
+ *
+ *  Paramaters:
+ *   options - The program options holding the mode and pattern
+ *   dict - The dictionary to search
+ *
+ *   Returns the match set in dictionary order
+ *
+ * */
+DictionaryWords *search_words(Options *options, DictionaryWords *dict) {
+    bool isPrefix = options->searchType == SEARCH_PREFIX;
+    ScanBounds bounds;
+    /* The first matches in sorted order could be anywhere */
+    bounds.limit = options->sort && !options->isCountSpecified ? 0 :
+            options->limit;
+    bounds.isCounting = options->isCountSpecified;
+    DictionaryWords *matches;
+
+    if (options->searchType != SEARCH_ANYWHERE &&
+            options->backend == BACKEND_BITSET && dict->letterIndex) {
+        matches = letter_index_match(dict->letterIndex, dict,
+                options->pattern, isPrefix);
+    } else if (options->searchType != SEARCH_ANYWHERE &&
+            options->backend == BACKEND_DAWG && dict->dawg) {
+        matches = dawg_match(dict->dawg, dict, options->pattern, isPrefix);
+    } else if (options->searchType == SEARCH_ANYWHERE &&
+            options->backend == BACKEND_FM && dict->fmIndex) {
+        matches = fm_index_match(dict->fmIndex, dict, options->pattern);
+    } else if (options->searchType == SEARCH_PREFIX) {
+        matches = pattern_match_words_prefix(options->pattern, dict,
+                options->threads, &bounds);
+    } else if (options->searchType == SEARCH_ANYWHERE) {
+        matches = pattern_match_words_anywhere(options->pattern, dict,
+                options->threads, &bounds);
+    } else {
+        matches = pattern_match_words_exact(options->pattern, dict,
+                options->threads, &bounds);
+    }
+
+    /* The indexes find every match, the first are kept the same way */
+    if (bounds.limit && matches->size > bounds.limit) {
+        matches->size = bounds.limit;
+    }
+    return matches;
+}
+
+/**
+ *
+ *  Runs the search the options ask for over front coded words, matching
+ *  each word as the cursor decodes it. The words are scanned in one pass
+ *  on the calling thread. -limit and -count are kept to as search_words()
+ *  keeps to them, a count leaving the dictionary with no words but its
+ *  size.
+ *
+ *  Paramaters:
+ *   options - The program options holding the mode and pattern
+ *   coded - The front coded words to search
+ *
+ *   Returns a dictionary holding copies of the matches in dictionary order
+ *
+ * */
+DictionaryWords *search_front_coded(Options *options, FrontCoded *coded) {
+    ScanQuery query;
+    compile_pattern(&query.compiled, options->pattern);
+    query.matchAll = options->searchType == SEARCH_PREFIX &&
+            is_match_all_prefix(options->pattern);
+
+    int limit = options->sort && !options->isCountSpecified ? 0 :
+            options->limit;
+
+    DictionaryWords *matches = dict_words_init();
+    FrontCodedCursor cursor;
+    front_coded_cursor_init(&cursor, coded, 0);
+    while ((limit == 0 || matches->size < limit) &&
+            front_coded_next(&cursor)) {
+        uint32_t wordInfo = cursor.length |
+                (cursor.alphaLength == cursor.length ? WORD_ALPHA_BIT : 0);
+        bool isMatch;
+        switch (options->searchType) {
+            case SEARCH_PREFIX:
+                isMatch = query.matchAll ? (wordInfo & WORD_ALPHA_BIT) &&
+                        cursor.length >= query.compiled.length :
+                        is_word_a_prefix_match(cursor.folded, wordInfo,
+                        &query.compiled, cursor.readableBytes);
+                break;
+            case SEARCH_ANYWHERE:
+                isMatch = is_word_an_anywhere_match(cursor.folded, wordInfo,
+                        &query.compiled);
+                break;
+            default:
+                isMatch = is_word_an_exact_match(cursor.folded, wordInfo,
+                        &query.compiled, cursor.readableBytes);
+        }
+        if (isMatch && options->isCountSpecified) {
+            matches->size++;
+        } else if (isMatch) {
+            dict_words_add(matches, cursor.word, cursor.length);
+        }
+    }
+    stats_add(COUNT_WORDS_SCANNED, cursor.id + 1);
+    front_coded_cursor_free(&cursor);
+
+    return matches;
+}
+
+/**
+ *
+ *  Sorts a dictionary of matches copied out of front coded words into
+ *  the order -sort prints in.
+ *
+ *  Paramaters:
+ *   words - The matches to sort, freed
+ *   limit - How many of the first words in sorted order to keep, 0 for all
+ *
+ *   Returns a dictionary of the same words in sorted order
+ *
+ * */
+DictionaryWords *sort_word_list(DictionaryWords *words, int limit) {
+    dict_words_normalize(words);
+    collate_build(words);
+
+    int count = limit && limit < words->size ? limit : words->size;
+    DictionaryWords *sorted = dict_words_init();
+    for (int i = 0; i < count; i++) {
+        int id = words->sortedIds[i];
+        dict_words_add(sorted, words->arena + words->offsets[id],
+                words->wordInfo[id] & WORD_LENGTH_MASK);
+    }
+    dict_words_free(words);
+
+    return sorted;
+}
+
+/**
+ *
+ *  Builds the index the chosen backend needs, if the search mode is one
+ *  the backend can answer. When an index file is being built or queries
+ *  are served the index is built for every mode, and indexes loaded from
+ *  a file are kept.
+ *
+ *  Paramaters:
+ *   options - The program options holding the backend and mode
+ *   dict - The dictionary to index
+ *
+ *   Returns nothing
+ *
+ * */
+void build_backend_index(Options *options, DictionaryWords *dict) {
+    bool isAnywhere = options->searchType == SEARCH_ANYWHERE;
+    bool isAnyMode = options->indexFilename != NULL ||
+            options->socketPath != NULL;
+
+    switch (options->backend) {
+        case BACKEND_BITSET:
+            if ((!isAnywhere || isAnyMode) && !dict->letterIndex) {
+                dict->letterIndex = letter_index_build(dict);
+            }
+            break;
+        case BACKEND_DAWG:
+            if ((!isAnywhere || isAnyMode) && !dict->dawg) {
+                dict->dawg = dawg_build(dict);
+            }
+            break;
+        case BACKEND_FM:
+            if ((isAnywhere || isAnyMode) && !dict->fmIndex) {
+                dict->fmIndex = fm_index_build(dict);
+                if (dict->fmIndex == NULL) {
+                    fprintf(stderr, "search: too many letters for the fm"
+                            " backend, scanning instead\n");
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ *
+ *  Loads the dictionary to search, from an index file if the file is one.
+ *  An index whose word list has changed since it was built, or that is
+ *  corrupt, is ignored with a warning and the word list is read instead.
+ *
+ *  Paramaters:
+ *   filename - The word list or index file to load
+ *   wordsFilename - Set to the word list the words came from, unless NULL
+ *
+ *   Returns the dictionary words
+ *
+ * */
+DictionaryWords *load_dictionary(char *filename, char *wordsFilename) {
+    if (!is_index_file(filename)) {
+        if (wordsFilename) {
+            snprintf(wordsFilename, PATH_MAX, "%s", filename);
+        }
+        return read_words_from_file(filename);
+    }
+
+    DictionaryWords *dict;
+    char sourceFilename[PATH_MAX];
+    IndexStatus status = index_file_load(filename, &dict, sourceFilename);
+    if (wordsFilename && (status == INDEX_OK || status == INDEX_STALE ||
+            status == INDEX_CORRUPT)) {
+        strcpy(wordsFilename, sourceFilename);
+    }
+    switch (status) {
+        case INDEX_OK:
+            stats_add(COUNT_BYTES_READ, dict->indexMappingSize);
+            return dict;
+        case INDEX_STALE:
+            fprintf(stderr, "search: index \"%s\" is out of date,"
+                    " reading \"%s\"\n", filename, sourceFilename);
+            exit_on_incorrect_file_access(sourceFilename);
+            return read_words_from_file(sourceFilename);
+        case INDEX_CORRUPT:
+            fprintf(stderr, "search: index \"%s\" is corrupt,"
+                    " reading \"%s\"\n", filename, sourceFilename);
+            exit_on_incorrect_file_access(sourceFilename);
+            return read_words_from_file(sourceFilename);
+        case INDEX_BAD_VERSION:
+            fprintf(stderr, "search: index \"%s\" was built by another"
+                    " version of search\n", filename);
+            exit(EXIT_FAILURE);
+        default:
+            fprintf(stderr, "search: index \"%s\" is corrupt\n", filename);
+            exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ *
+ *  The body of a thread loading one of several dictionary files.
+ *
+ *  Paramaters:
+ *   loadInfo - The DictionaryLoad naming the file, given its dictionary
+ *
+ *   Returns NULL
+ *
+ * */
+void *load_dictionary_thread(void *loadInfo) {
+    DictionaryLoad *load = (DictionaryLoad*) loadInfo;
+    load->dict = load_dictionary(load->filename, NULL);
+    return NULL;
+}
+
+/**
+ *
+ *  Loads every dictionary file of the options, each on its own thread
+ *  when there are several, and joins them into one dictionary without
+ *  the words repeated across or within them. A single file is loaded as
+ *  it is.
+ *
+ *  Paramaters:
+ *   options - The program options holding the dictionary files
+ *
+ *   Returns the dictionary words
+ *
+ * */
+DictionaryWords *load_dictionaries(Options *options) {
+    int count = options->dictionaryCount;
+    if (count == 1) {
+        return load_dictionary(options->dictionaryFilename, NULL);
+    }
+
+    DictionaryLoad *loads = (DictionaryLoad*) malloc(count *
+            sizeof(DictionaryLoad));
+    pthread_t *tids = (pthread_t*) malloc(count * sizeof(pthread_t));
+    for (int i = 0; i < count; i++) {
+        loads[i].filename = options->dictionaryFilenames[i];
+        pthread_create(&tids[i], NULL, load_dictionary_thread, &loads[i]);
+    }
+    DictionaryWords **dicts = (DictionaryWords**) malloc(count *
+            sizeof(DictionaryWords*));
+    for (int i = 0; i < count; i++) {
+        pthread_join(tids[i], NULL);
+        dicts[i] = loads[i].dict;
+    }
+    free(tids);
+    free(loads);
+
+    DictionaryWords *dict = merge_dictionaries(dicts, count);
+    for (int i = 0; i < count; i++) {
+        dict_words_free(dicts[i]);
+    }
+    free(dicts);
+    return dict;
+}
+
+/**
+ *
+ *  Reads a word list, builds the chosen backend's index over it and saves
+ *  both to the index file named in the options, then exits.
+ *
+ *  Paramaters:
+ *   options - The program options holding the files and backend
+ *
+ *   Returns nothing
+ *
+ * */
+void build_index_file(Options *options) {
+    stats_enter_phase(PHASE_LOAD);
+    DictionaryWords *dict = read_words_from_file(options->dictionaryFilename);
+    build_backend_index(options, dict);
+    collate_build(dict);
+
+    if (!index_file_write(dict, options->dictionaryFilename,
+            options->indexFilename)) {
+        fprintf(stderr, "search: index \"%s\" can not be written\n",
+                options->indexFilename);
+        exit(EXIT_FAILURE);
+    }
+
+    dict_words_free(dict);
+    stats_report(stderr);
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ *
+ *  Copies the words of the matches in the loaded words, then those in the
+ *  words appended since, into one dictionary.
+ *
+ *  Paramaters:
+ *   matches - The matches in the loaded words, freed
+ *   deltaMatches - The matches in the appended words, freed
+ *
+ *   Returns the joined matches in file order
+ *
+ * */
+DictionaryWords *join_delta_matches(DictionaryWords *matches,
+        DictionaryWords *deltaMatches) {
+    DictionaryWords *joined = dict_words_init();
+    for (int i = 0; i < matches->size; i++) {
+        dict_words_add(joined, dict_words_get(matches, i),
+                dict_words_length(matches, i));
+    }
+    for (int i = 0; i < deltaMatches->size; i++) {
+        dict_words_add(joined, dict_words_get(deltaMatches, i),
+                dict_words_length(deltaMatches, i));
+    }
+    dict_words_free(matches);
+    dict_words_free(deltaMatches);
+
+    return joined;
+}
+
+/**
+ *
+ *  Answers one query sent to -serve, searching single threaded since the
+ *  workers already run queries side by side. The query keeps the current
+ *  snapshot of the dictionary until its answer is released, so a refresh
+ *  can't free the words under it.
+ *
+ *  The matches in the loaded words are taken from the result cache when
+ *  the same query was answered in the same generation of the snapshot.
+ *  Front coded words have no ids to cache, so they are always searched.
+ *
+ *  Paramaters:
+ *   query - The mode, pattern and sort flag asked for
+ *   context - The ServeContext to search with
+ *
+ *   Returns the match set or NULL if the pattern is not valid
+ *
+ * */
+DictionaryWords *answer_query(Query *query, void *context) {
+    ServeContext *serve = (ServeContext*) context;
+    if (!is_valid_pattern(query->pattern)) {
+        return NULL;
+    }
+
+    Options options = *serve->options;
+    options.pattern = query->pattern;
+    options.threads = 1;
+    MatchMode mode;
+    switch (query->mode) {
+        case REQUEST_PREFIX:
+            options.searchType = SEARCH_PREFIX;
+            mode = MATCH_PREFIX;
+            break;
+        case REQUEST_ANYWHERE:
+            options.searchType = SEARCH_ANYWHERE;
+            mode = MATCH_ANYWHERE;
+            break;
+        default:
+            options.searchType = SEARCH_EXACT;
+            mode = MATCH_EXACT;
+    }
+
+    Snapshot *snapshot = refresh_acquire(serve->refresher);
+    query->handle = snapshot;
+    if (snapshot->coded) {
+        DictionaryWords *matches = search_front_coded(&options,
+                snapshot->coded);
+        if (snapshot->delta) {
+            matches = join_delta_matches(matches,
+                    search_words(&options, snapshot->delta));
+        }
+        return query->sort ? sort_word_list(matches, 0) : matches;
+    }
+
+    /* With appended words the matches are sorted once joined */
+    bool isSorted = query->sort && !snapshot->delta;
+    DictionaryWords *matches = result_cache_get(serve->cache,
+            snapshot->generation, mode, query->pattern, isSorted,
+            snapshot->dict);
+    if (matches == NULL) {
+        matches = search_words(&options, snapshot->dict);
+        if (isSorted) {
+            collate_sort_matches(matches);
+        }
+        result_cache_put(serve->cache, snapshot->generation, mode,
+                query->pattern, isSorted, matches);
+    }
+
+    if (snapshot->delta) {
+        matches = join_delta_matches(matches,
+                search_words(&options, snapshot->delta));
+        return query->sort ? sort_word_list(matches, 0) : matches;
+    }
+    return matches;
+}
+
+/**
+ *
+ *  Frees the answer to a -serve query once it is sent and lets go of the
+ *  snapshot it was found in.
+ *
+ *  Paramaters:
+ *   query - The query answered
+ *   matches - The answer
+ *   context - The ServeContext the query was answered with
+ *
+ *   Returns nothing
+ *
+ * */
+void release_answer(Query *query, DictionaryWords *matches, void *context) {
+    ServeContext *serve = (ServeContext*) context;
+    dict_words_free(matches);
+    refresh_release(serve->refresher, (Snapshot*) query->handle);
+}
+
+/**
+ *
+ *  Loads the dictionary -serve answers from and prepares it for queries,
+ *  when the server starts and whenever its files are rewritten. With
+ *  -compact only the front coded words are kept.
+ *
+ *  Paramaters:
+ *   loaded - Set to the words and the word list they came from
+ *   context - The ServeContext holding the options
+ *
+ *   Returns false if the dictionary can no longer be read
+ *
+ * */
+bool load_served_words(LoadedWords *loaded, void *context) {
+    Options *options = ((ServeContext*) context)->options;
+    if (access(options->dictionaryFilename, R_OK) == -1) {
+        return false;
+    }
+
+    loaded->dict = load_dictionary(options->dictionaryFilename,
+            loaded->wordsFilename);
+    if (options->isCompactSpecified) {
+        loaded->coded = front_coded_build(loaded->dict);
+        dict_words_free(loaded->dict);
+        loaded->dict = NULL;
+    } else {
+        build_backend_index(options, loaded->dict);
+        collate_build(loaded->dict);
+    }
+    return true;
+}
+
+/**
+ *
+ *  Loads the dictionary and answers queries on the socket named in the
+ *  options until killed. Words appended to the word list are picked up
+ *  as they are written and rewritten files are reloaded in the
+ *  background, see refresh_start().
+ *
+ *  Paramaters:
+ *   options - The program options holding the socket and dictionary
+ *
+ *   Returns nothing
+ *
+ * */
+void serve_dictionary(Options *options) {
+    ServeContext serve = {options, NULL, result_cache_init()};
+    char *indexFilename = is_index_file(options->dictionaryFilename) ?
+            options->dictionaryFilename : NULL;
+    serve.refresher = refresh_start(indexFilename, load_served_words,
+            &serve);
+    if (serve.refresher == NULL) {
+        fprintf(stderr, "search: file \"%s\" can not be opened\n",
+                options->dictionaryFilename);
+        exit(EXIT_FAILURE);
+    }
+
+    serve_queries(options->socketPath, options->threads, answer_query,
+            release_answer, &serve);
+    fprintf(stderr, "search: can not listen on \"%s\"\n",
+            options->socketPath);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ *
+ *  Reads the patterns of a -patterns file, one per line. A line may start
+ *  with -exact, -prefix or -anywhere and a space to give its own mode,
+ *  otherwise the mode from the command line is used. Blank lines are
+ *  skipped and an invalid pattern ends the program.
+ *
+ *  Paramaters:
+ *   options - The program options holding the file and default mode
+ *   count - Set to the number of patterns read
+ *
+ *   Returns the patterns, each with its own copy of the line
+ *
+ * */
+BatchPattern *read_pattern_file(Options *options, int *count) {
+    FILE *file = fopen(options->patternsFilename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "search: file \"%s\" can not be opened\n",
+                options->patternsFilename);
+        exit(EXIT_FAILURE);
+    }
+
+    int memsize = 64;
+    BatchPattern *patterns = (BatchPattern*) malloc(memsize *
+            sizeof(BatchPattern));
+    char *line = NULL;
+    size_t lineMemsize = 0;
+    ssize_t length;
+    *count = 0;
+    while ((length = getline(&line, &lineMemsize, file)) != -1) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[--length] = 0;
+        }
+        if (length == 0) {
+            continue;
+        }
+
+        MatchMode mode = options->searchType == SEARCH_PREFIX ?
+                MATCH_PREFIX : options->searchType == SEARCH_ANYWHERE ?
+                MATCH_ANYWHERE : MATCH_EXACT;
+        char *pattern = line;
+        char *space = strchr(line, ' ');
+        if (line[0] == '-' && space != NULL) {
+            *space = 0;
+            OptionType type = get_option_type(line);
+            if (type != SEARCH_EXACT && type != SEARCH_PREFIX &&
+                    type != SEARCH_ANYWHERE) {
+                *space = ' ';
+            } else {
+                mode = type == SEARCH_PREFIX ? MATCH_PREFIX :
+                        type == SEARCH_ANYWHERE ? MATCH_ANYWHERE :
+                        MATCH_EXACT;
+                pattern = space + 1;
+            }
+        }
+        if (!is_valid_pattern(pattern)) {
+            fprintf(stderr, "search: pattern should only"
+                    " contain question marks and letters\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (*count == memsize) {
+            memsize *= 2;
+            patterns = (BatchPattern*) realloc(patterns, memsize *
+                    sizeof(BatchPattern));
+        }
+        patterns[*count].pattern = strdup(pattern);
+        patterns[*count].mode = mode;
+        (*count)++;
+    }
+
+    free(line);
+    fclose(file);
+    return patterns;
+}
+
+/**
+ *
+ *  Orders the indexes of batch patterns by the key results are cached
+ *  under: the mode, then the pattern ignoring case. Patterns with the
+ *  same key stay in file order. Meant to be used with qsort_r().
+ *
+ *  Paramaters:
+ *   firstIndex - A pointer to the index of the first pattern
+ *   secondIndex - A pointer to the index of the second pattern
+ *   patterns - The BatchPattern array the indexes refer to
+ *
+ *   Returns less than, equal to or greater than 0 like strcmp
+ *
+ * */
+int compare_batch_keys(const void *firstIndex, const void *secondIndex,
+        void *patterns) {
+    int first = *(int*) firstIndex;
+    int second = *(int*) secondIndex;
+    BatchPattern *batch = (BatchPattern*) patterns;
+    if (batch[first].mode != batch[second].mode) {
+        return batch[first].mode - batch[second].mode;
+    }
+    int order = strcasecmp(batch[first].pattern, batch[second].pattern);
+    return order ? order : first - second;
+}
+
+/**
+ *
+ *  Matches every pattern of a -patterns file in one pass over the
+ *  dictionary, then prints each pattern's matches as the pattern, a tab
+ *  and the word, pattern by pattern in file order. Exits when done.
+ *
+ *  A pattern repeated in the file, in any case, is matched and sorted
+ *  once and its repeats print the same matches. The run starts with
+ *  nothing cached, so this is all the result cache would save it.
+ *
+ *  Paramaters:
+ *   options - The program options holding the files and sort flag
+ *
+ *   Returns nothing
+ *
+ * */
+void run_pattern_batch(Options *options) {
+    stats_enter_phase(PHASE_LOAD);
+    int count;
+    BatchPattern *patterns = read_pattern_file(options, &count);
+    DictionaryWords *dict = load_dictionaries(options);
+
+    stats_enter_phase(PHASE_MATCH);
+    ScanQuery *queries = (ScanQuery*) malloc((count + 1) * sizeof(ScanQuery));
+    for (int i = 0; i < count; i++) {
+        compile_pattern(&queries[i].compiled, patterns[i].pattern);
+        queries[i].matchAll = patterns[i].mode == MATCH_PREFIX &&
+                is_match_all_prefix(patterns[i].pattern);
+        /* batch_match counts the words it rules out itself */
+        queries[i].isCountingRejected = false;
+        patterns[i].query = &queries[i];
+        patterns[i].predicate = patterns[i].mode == MATCH_PREFIX ?
+                prefix_scan_predicate : patterns[i].mode == MATCH_ANYWHERE ?
+                anywhere_scan_predicate : exact_scan_predicate;
+    }
+
+    /* firstOf[i] is the first pattern with the same key as pattern i, the
+     * one that is matched for both */
+    int *order = (int*) malloc((count + 1) * sizeof(int));
+    int *firstOf = (int*) malloc((count + 1) * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    qsort_r(order, count, sizeof(int), compare_batch_keys, patterns);
+    for (int k = 0; k < count; k++) {
+        int i = order[k];
+        firstOf[i] = k > 0 && patterns[i].mode ==
+                patterns[order[k - 1]].mode && !strcasecmp(
+                patterns[i].pattern, patterns[order[k - 1]].pattern) ?
+                firstOf[order[k - 1]] : i;
+    }
+    free(order);
+
+    BatchPattern *unique = (BatchPattern*) malloc((count + 1) *
+            sizeof(BatchPattern));
+    int uniqueCount = 0;
+    for (int i = 0; i < count; i++) {
+        if (firstOf[i] == i) {
+            unique[uniqueCount++] = patterns[i];
+        }
+    }
+
+    batch_match(dict, unique, uniqueCount);
+    if (options->sort) {
+        stats_enter_phase(PHASE_SORT);
+        collate_build(dict);
+    }
+    for (int u = 0, i = 0; u < uniqueCount; i++) {
+        if (firstOf[i] == i) {
+            patterns[i].matches = unique[u++].matches;
+            if (options->sort) {
+                collate_sort_matches(patterns[i].matches);
+            }
+        }
+    }
+    free(unique);
+
+    OutputWriter *writer = output_writer_init(STDOUT_FILENO);
+    for (int i = 0; i < count; i++) {
+        DictionaryWords *matches = patterns[firstOf[i]].matches;
+        stats_enter_phase(PHASE_PRINT);
+        size_t patternLength = strlen(patterns[i].pattern);
+        for (int k = 0; k < matches->size; k++) {
+            output_write(writer, patterns[i].pattern, patternLength);
+            output_write(writer, "\t", 1);
+            output_write_word(writer, dict_words_get(matches, k),
+                    dict_words_length(matches, k));
+        }
+    }
+    stats_enter_phase(PHASE_PRINT);
+    output_writer_free(writer);
+
+    for (int i = 0; i < count; i++) {
+        if (firstOf[i] == i) {
+            dict_words_free(patterns[i].matches);
+        }
+        free(patterns[i].pattern);
+    }
+    free(firstOf);
+    free(queries);
+    free(patterns);
+    dict_words_free(dict);
+    stats_report(stderr);
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ *
+ *  Prints one buffer of streamed matches, flushing them so they are seen
+ *  while the rest of the file is still being searched.
+ *
+ *  Paramaters:
+ *   matches - The matches of the buffer
+ *   context - The OutputWriter to print with
+ *
+ *   Returns nothing
+ *
+ * */
+void print_streamed_matches(DictionaryWords *matches, void *context) {
+    OutputWriter *writer = (OutputWriter*) context;
+    for (int i = 0; i < matches->size; i++) {
+        output_write_word(writer, dict_words_get(matches, i),
+                dict_words_length(matches, i));
+    }
+    output_flush(writer);
+}
+
+/**
+ *
+ *  Searches the word file a buffer at a time without loading it, printing
+ *  the matches in file order as they are found. Exits when done.
+ *
+ *  Paramaters:
+ *   options - The program options holding the file, mode and pattern
+ *
+ *   Returns nothing
+ *
+ * */
+void stream_dictionary(Options *options) {
+    ScanQuery query;
+    compile_pattern(&query.compiled, options->pattern);
+    query.matchAll = options->searchType == SEARCH_PREFIX &&
+            is_match_all_prefix(options->pattern);
+    query.isCountingRejected = stats_is_enabled();
+    WordPredicate predicate = options->searchType == SEARCH_PREFIX ?
+            prefix_scan_predicate : options->searchType == SEARCH_ANYWHERE ?
+            anywhere_scan_predicate : exact_scan_predicate;
+
+    /* Reading, matching and printing overlap, so it is all one phase */
+    stats_enter_phase(PHASE_MATCH);
+    OutputWriter *writer = output_writer_init(STDOUT_FILENO);
+    if (!stream_search(options->dictionaryFilename, predicate, &query,
+            options->threads, print_streamed_matches, writer)) {
+        /* What matched before the failure is still printed */
+        int error = errno;
+        output_writer_free(writer);
+        fprintf(stderr, "search: file \"%s\" can not be read: %s\n",
+                options->dictionaryFilename, strerror(error));
+        exit(EXIT_FAILURE);
+    }
+    output_writer_free(writer);
+    stats_report(stderr);
+    exit(EXIT_SUCCESS);
+}
+
 int main(int argc, char **argv) {
 
     Options *options = parse_options(argc, argv);
     if (!options) {
         print_usage(stderr, EXIT_FAILURE);
     } else {
-        if (options->dictionaryFilename) {
-            exit_on_incorrect_file_access(options->dictionaryFilename);
+        if (options->isStatsSpecified) {
+            stats_enable();
+        }
+
+        for (int i = 0; i < options->dictionaryCount; i++) {
+            exit_on_incorrect_file_access(options->dictionaryFilenames[i]);
+        }
+
+        if (options->indexFilename) {
+            build_index_file(options);
+        }
+
+        if (options->socketPath) {
+            serve_dictionary(options);
+        }
+
+        if (options->patternsFilename) {
+            run_pattern_batch(options);
         }
 
         if (!is_valid_pattern(options->pattern)) {
@@ -610,31 +1721,54 @@ int main(int argc, char **argv) {
             exit(EXIT_FAILURE);
         }
 
-        DictionaryWords *dict = read_words_from_file(
-                options->dictionaryFilename);
-        DictionaryWords *matches; 
-        switch (options->searchType) {
-            case SEARCH_PREFIX:
-                matches = pattern_match_words_prefix(options->pattern, dict);
-                break;
-            case SEARCH_ANYWHERE:
-                matches = pattern_match_words_anywhere(options->pattern, dict);
-                break;
-            default:
-                matches = pattern_match_words_exact(options->pattern, dict);
+        if (options->isStreamSpecified) {
+            stream_dictionary(options);
         }
 
-        if (options->sort) {
-            qsort(matches->words, matches->size ,sizeof(char *),
-                    compare_words);
+        stats_enter_phase(PHASE_LOAD);
+        DictionaryWords *dict = load_dictionaries(options);
+        FrontCoded *coded = NULL;
+        if (options->isCompactSpecified) {
+            coded = front_coded_build(dict);
+            dict_words_free(dict);
+            dict = NULL;
+        } else {
+            build_backend_index(options, dict);
+        }
+        stats_enter_phase(PHASE_MATCH);
+        DictionaryWords *matches = coded ?
+                search_front_coded(options, coded) :
+                search_words(options, dict);
+
+        if (options->sort && !options->isCountSpecified) {
+            stats_enter_phase(PHASE_SORT);
+            if (coded) {
+                matches = sort_word_list(matches, options->limit);
+            } else if (options->limit) {
+                collate_build(dict);
+                collate_top_matches(matches, options->limit);
+            } else {
+                collate_build(dict);
+                collate_sort_matches(matches);
+            }
         }
 
-        for (int i = 0; i < matches->size; i++) {
-            printf("%s\n", matches->words[i]);
+        stats_enter_phase(PHASE_PRINT);
+        if (options->isCountSpecified) {
+            printf("%d\n", matches->size);
+        } else {
+            OutputWriter *writer = output_writer_init(STDOUT_FILENO);
+            for (int i = 0; i < matches->size; i++) {
+                output_write_word(writer, dict_words_get(matches, i),
+                        dict_words_length(matches, i));
+            }
+            output_writer_free(writer);
         }
 
         dict_words_free(matches);
         dict_words_free(dict);
+        front_coded_free(coded);
+        stats_report(stderr);
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "serve.h"
+#include "utils.h"
+
+/* How many bytes of words are gathered before a frame is sent */
+#define FRAME_SIZE 65536
+
+/* How long a client may take to send more of a request it started, or to
+ * read more of its answer */
+#define CLIENT_TIMEOUT_SECONDS 5
+
+/* The connections with a request waiting for a worker, the pipe workers
+ * hand connections back through once answered, and what answers their
+ * queries */
+typedef struct {
+    int clients[SERVE_QUEUE_SIZE];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    int returned[2];
+    QueryHandler handler;
+    QueryRelease release;
+    void *context;
+} ServeState;
+
+/* A response being gathered into frames */
+typedef struct {
+    int client;
+    char *buffer;
+    size_t used;
+    size_t capacity;
+    bool isBroken; /* the client went away */
+} ResponseWriter;
+
+/**
+ * Reads exactly the number of bytes asked for from a socket.
+ *
+ * Parameters:
+ *  fd - the socket
+ *  buffer - where to put the bytes
+ *  size - how many bytes to read
+ *
+ * Returns true if all the bytes were read, false on end of file or error
+ * */
+static bool read_fully(int fd, void *buffer, size_t size) {
+    char *position = (char*) buffer;
+    while (size > 0) {
+        ssize_t got = read(fd, position, size);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        position += got;
+        size -= got;
+    }
+    return true;
+}
+
+/**
+ * Writes all of a buffer to a socket, without raising SIGPIPE if the
+ * client has gone away. A send that times out with EAGAIN fails too, so
+ * a client that stopped reading is dropped.
+ *
+ * Parameters:
+ *  fd - the socket
+ *  buffer - the bytes to write
+ *  size - how many bytes to write
+ *
+ * Returns true if all the bytes were written
+ * */
+static bool write_fully(int fd, const void *buffer, size_t size) {
+    const char *position = (const char*) buffer;
+    while (size > 0) {
+        ssize_t sent = send(fd, position, size, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        position += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+/**
+ * Sends the gathered words as one frame, or the empty frame that ends
+ * a response if nothing is gathered.
+ *
+ * Parameters:
+ *  writer - the response being written
+ *
+ * Returns nothing
+ * */
+static void flush_frame(ResponseWriter *writer) {
+    uint32_t length = htonl(writer->used);
+    if (!writer->isBroken) {
+        writer->isBroken = !write_fully(writer->client, &length,
+                sizeof(length)) || !write_fully(writer->client,
+                writer->buffer, writer->used);
+    }
+    writer->used = 0;
+}
+
+/**
+ * Adds a word and its newline to the response, sending a frame first if
+ * the word would not fit.
+ *
+ * Parameters:
+ *  writer - the response being written
+ *  word - the word to add
+ *  length - the length of the word
+ *
+ * Returns nothing
+ * */
+static void write_word(ResponseWriter *writer, const char *word,
+        size_t length) {
+    if (writer->used + length + 1 > writer->capacity && writer->used > 0) {
+        flush_frame(writer);
+    }
+    if (length + 1 > writer->capacity) {
+        writer->capacity = length + 1;
+        writer->buffer = (char*) realloc(writer->buffer, writer->capacity);
+    }
+    memcpy(writer->buffer + writer->used, word, length);
+    writer->buffer[writer->used + length] = '\n';
+    writer->used += length + 1;
+}
+
+/**
+ * Reads one request from a client and sends back its answer.
+ *
+ * Parameters:
+ *  state - the server, holding the query handler
+ *  client - the client's socket
+ *
+ * Returns false once the client has closed or broken the connection
+ * */
+static bool serve_request(ServeState *state, int client) {
+    unsigned char header[REQUEST_HEADER_SIZE];
+    if (!read_fully(client, header, sizeof(header))) {
+        return false;
+    }
+
+    size_t patternLength = (header[2] << 8) | header[3];
+    char *pattern = (char*) malloc(patternLength + 1);
+    if (!read_fully(client, pattern, patternLength)) {
+        free(pattern);
+        return false;
+    }
+    pattern[patternLength] = 0;
+
+    Query query = {header[0], header[1] & REQUEST_SORT, pattern, NULL};
+    DictionaryWords *matches = NULL;
+    if (query.mode == REQUEST_EXACT || query.mode == REQUEST_PREFIX ||
+            query.mode == REQUEST_ANYWHERE) {
+        matches = state->handler(&query, state->context);
+    }
+    free(pattern);
+
+    unsigned char status = matches ? RESPONSE_OK : RESPONSE_BAD_REQUEST;
+    if (matches == NULL) {
+        return write_fully(client, &status, sizeof(status));
+    }
+    if (!write_fully(client, &status, sizeof(status))) {
+        state->release(&query, matches, state->context);
+        return false;
+    }
+
+    ResponseWriter writer = {client, (char*) malloc(FRAME_SIZE), 0,
+            FRAME_SIZE, false};
+    for (int i = 0; i < matches->size && !writer.isBroken; i++) {
+        write_word(&writer, dict_words_get(matches, i),
+                dict_words_length(matches, i));
+    }
+    if (writer.used > 0) {
+        flush_frame(&writer);
+    }
+    flush_frame(&writer);
+
+    free(writer.buffer);
+    state->release(&query, matches, state->context);
+    return !writer.isBroken;
+}
+
+/**
+ * A worker thread: answers one request of each connection taken from the
+ * queue, then hands the connection back to be polled for the next, so an
+ * idle client never holds a worker.
+ *
+ * Parameters:
+ *  arg - the server state
+ *
+ * Returns nothing, it never exits
+ * */
+static void *serve_connections(void *arg) {
+    ServeState *state = (ServeState*) arg;
+    while (true) {
+        pthread_mutex_lock(&state->lock);
+        while (state->count == 0) {
+            pthread_cond_wait(&state->notEmpty, &state->lock);
+        }
+        int client = state->clients[state->head];
+        state->head = (state->head + 1) % SERVE_QUEUE_SIZE;
+        state->count--;
+        pthread_cond_signal(&state->notFull);
+        pthread_mutex_unlock(&state->lock);
+
+        if (!serve_request(state, client) || write(state->returned[1],
+                &client, sizeof(client)) != sizeof(client)) {
+            close(client);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Puts a connection with a request waiting into the queue for a worker,
+ * waiting for room if the queue is full.
+ *
+ * Parameters:
+ *  state - the server state
+ *  client - the client's socket
+ *
+ * Returns nothing
+ * */
+static void queue_connection(ServeState *state, int client) {
+    pthread_mutex_lock(&state->lock);
+    while (state->count == SERVE_QUEUE_SIZE) {
+        pthread_cond_wait(&state->notFull, &state->lock);
+    }
+    state->clients[(state->head + state->count) % SERVE_QUEUE_SIZE] = client;
+    state->count++;
+    pthread_cond_signal(&state->notEmpty);
+    pthread_mutex_unlock(&state->lock);
+}
+
+/**
+ * Adds a connection to the set being polled, growing the set if needed.
+ *
+ * Parameters:
+ *  polled - the set, its first two entries are the listening socket and
+ *      the pipe of returned connections
+ *  count - the number of entries in the set, increased
+ *  capacity - the room in the set, increased when it grows
+ *  client - the client's socket
+ *
+ * Returns nothing
+ * */
+static void poll_connection(struct pollfd **polled, int *count,
+        int *capacity, int client) {
+    if (*count == *capacity) {
+        *capacity *= 2;
+        *polled = (struct pollfd*) realloc(*polled,
+                *capacity * sizeof(struct pollfd));
+    }
+    (*polled)[*count].fd = client;
+    (*polled)[*count].events = POLLIN;
+    (*polled)[*count].revents = 0;
+    (*count)++;
+}
+
+/**
+ * Creates the listening socket at a path, replacing a stale socket left
+ * there by an earlier server.
+ *
+ * Parameters:
+ *  socketPath - where to create the socket
+ *
+ * Returns the listening socket or -1 on error
+ * */
+static int listen_on_path(char *socketPath) {
+    struct sockaddr_un address;
+    struct stat info;
+
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    if (stat(socketPath, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(socketPath);
+    }
+
+    int serverSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (serverSocket == -1) {
+        return -1;
+    }
+    if (bind(serverSocket, (struct sockaddr*) &address,
+            sizeof(address)) == -1 || listen(serverSocket, 128) == -1) {
+        close(serverSocket);
+        return -1;
+    }
+    return serverSocket;
+}
+
+int serve_queries(char *socketPath, int workers, QueryHandler handler,
+        QueryRelease release, void *context) {
+    int serverSocket = listen_on_path(socketPath);
+    if (serverSocket == -1) {
+        return -1;
+    }
+
+    ServeState *state = (ServeState*) malloc(sizeof(ServeState));
+    memset(state, 0, sizeof(ServeState));
+    if (pipe(state->returned) == -1) {
+        close(serverSocket);
+        free(state);
+        return -1;
+    }
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->notEmpty, NULL);
+    pthread_cond_init(&state->notFull, NULL);
+    state->handler = handler;
+    state->release = release;
+    state->context = context;
+
+    for (int i = 0; i < workers; i++) {
+        pthread_t tid;
+        pthread_create(&tid, NULL, serve_connections, state);
+        pthread_detach(tid);
+    }
+
+    /* Connections are only polled while no worker has them */
+    int capacity = 64;
+    int count = 0;
+    struct pollfd *polled = (struct pollfd*) malloc(capacity *
+            sizeof(struct pollfd));
+    poll_connection(&polled, &count, &capacity, serverSocket);
+    poll_connection(&polled, &count, &capacity, state->returned[0]);
+    struct timeval timeout = {CLIENT_TIMEOUT_SECONDS, 0};
+
+    while (true) {
+        if (poll(polled, count, -1) == -1) {
+            continue;
+        }
+
+        /* Ready connections leave the set, swapped for the last one */
+        for (int i = count - 1; i >= 2; i--) {
+            if (polled[i].revents) {
+                queue_connection(state, polled[i].fd);
+                polled[i] = polled[--count];
+            }
+        }
+        if (polled[1].revents & POLLIN) {
+            int client;
+            if (read_fully(state->returned[0], &client, sizeof(client))) {
+                poll_connection(&polled, &count, &capacity, client);
+            }
+        }
+        if (polled[0].revents & POLLIN) {
+            int client = accept(serverSocket, NULL, NULL);
+            if (client != -1) {
+                /* A client that stalls mid request, or stops reading its
+                 * answer, lets its worker go */
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                        sizeof(timeout));
+                setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                        sizeof(timeout));
+                poll_connection(&polled, &count, &capacity, client);
+            }
+        }
+    }
+    return -1;
+}
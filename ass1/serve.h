@@ -0,0 +1,61 @@
+#ifndef SERVE_H_
+#define SERVE_H_
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* How many connections with a request ready can wait for a free worker */
+#define SERVE_QUEUE_SIZE 64
+
+/* Request framing: a mode byte, a flags byte and a big endian 16 bit
+ * pattern length, followed by the pattern itself */
+#define REQUEST_HEADER_SIZE 4
+#define REQUEST_EXACT 0
+#define REQUEST_PREFIX 1
+#define REQUEST_ANYWHERE 2
+#define REQUEST_SORT 0x1
+
+/* Response framing: a status byte, then for RESPONSE_OK frames of
+ * newline terminated words, each after its big endian 32 bit length,
+ * ended by an empty frame */
+#define RESPONSE_OK 0
+#define RESPONSE_BAD_REQUEST 1
+
+/* A search asked for by a client */
+typedef struct {
+    int mode; /* one of the REQUEST_ modes */
+    bool sort;
+    char *pattern;
+    void *handle; /* set by the handler for its release */
+} Query;
+
+/* Answers a query, returning NULL if the query is not a valid search.
+ * Called from several worker threads at once. */
+typedef DictionaryWords *(*QueryHandler)(Query *query, void *context);
+
+/* Frees the matches of an answered query once they have been sent, and
+ * whatever the handler kept for them */
+typedef void (*QueryRelease)(Query *query, DictionaryWords *matches,
+        void *context);
+
+/**
+ * Listens on a Unix domain socket and answers the queries of every client
+ * that connects with a pool of worker threads. A client may send any
+ * number of requests on its connection, each answered in turn. Idle
+ * connections are polled, and a worker is only taken while a request is
+ * being answered.
+ *
+ * Parameters:
+ *  socketPath - where to create the socket, an old socket there is removed
+ *  workers - the number of worker threads
+ *  handler - answers each query
+ *  release - frees each answer once it is sent
+ *  context - passed to the handler and release untouched
+ *
+ * Returns -1 if the socket could not be set up, otherwise never returns
+ * */
+int serve_queries(char *socketPath, int workers, QueryHandler handler,
+        QueryRelease release, void *context);
+
+#endif
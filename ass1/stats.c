@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "stats.h"
+
+/* The hardware events counted for each phase */
+#define HARDWARE_COUNTERS 3
+
+static const uint64_t hardwareEvents[HARDWARE_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES
+};
+
+static const char *phaseNames[PHASE_COUNT] = {
+    "load", "match", "sort", "print"
+};
+
+/* The clocks and counters at one moment, or what a phase used of them */
+typedef struct {
+    double wallTime;
+    double cpuTime;
+    uint64_t events[HARDWARE_COUNTERS];
+} Figures;
+
+/* There is one set of statistics per run */
+static bool isEnabled = false;
+static int counterFds[HARDWARE_COUNTERS];
+static bool hasCounters = false;
+static StatsPhase runningPhase = PHASE_NONE;
+static Figures phaseStart; /* when the running phase was entered */
+static Figures phases[PHASE_COUNT];
+static long counts[COUNT_TOTAL];
+
+/**
+ * Reads a clock in milliseconds
+ *
+ * Parameters:
+ *  clock - the clock to read
+ *
+ * Returns the time
+ * */
+static double read_clock(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+/**
+ * Takes the clocks and hardware counters as they are now
+ *
+ * Parameters:
+ *  reading - where to put them
+ *
+ * Returns nothing
+ * */
+static void take_reading(Figures *reading) {
+    reading->wallTime = read_clock(CLOCK_MONOTONIC);
+    reading->cpuTime = read_clock(CLOCK_PROCESS_CPUTIME_ID);
+    for (int i = 0; i < HARDWARE_COUNTERS; i++) {
+        if (!hasCounters || read(counterFds[i], &reading->events[i],
+                sizeof(uint64_t)) != sizeof(uint64_t)) {
+            reading->events[i] = 0;
+        }
+    }
+}
+
+/**
+ * Opens a counter for a hardware event in user space, including threads
+ * started later so scans over many threads are counted too.
+ *
+ * Parameters:
+ *  event - the PERF_COUNT_HW event
+ *
+ * Returns the counter's file descriptor, -1 if it can't be opened
+ * */
+static int open_counter(uint64_t event) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = event;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void stats_enable() {
+    isEnabled = true;
+    hasCounters = true;
+    for (int i = 0; i < HARDWARE_COUNTERS; i++) {
+        counterFds[i] = open_counter(hardwareEvents[i]);
+        if (counterFds[i] == -1) {
+            hasCounters = false;
+        }
+    }
+    if (!hasCounters) {
+        for (int i = 0; i < HARDWARE_COUNTERS; i++) {
+            if (counterFds[i] != -1) {
+                close(counterFds[i]);
+            }
+        }
+    }
+}
+
+bool stats_is_enabled() {
+    return isEnabled;
+}
+
+void stats_enter_phase(StatsPhase phase) {
+    if (!isEnabled) {
+        return;
+    }
+
+    Figures now;
+    take_reading(&now);
+    if (runningPhase != PHASE_NONE) {
+        Figures *figures = &phases[runningPhase];
+        figures->wallTime += now.wallTime - phaseStart.wallTime;
+        figures->cpuTime += now.cpuTime - phaseStart.cpuTime;
+        for (int i = 0; i < HARDWARE_COUNTERS; i++) {
+            figures->events[i] += now.events[i] - phaseStart.events[i];
+        }
+    }
+    runningPhase = phase;
+    phaseStart = now;
+}
+
+void stats_add(StatsCount count, long amount) {
+    if (isEnabled) {
+        __atomic_fetch_add(&counts[count], amount, __ATOMIC_RELAXED);
+    }
+}
+
+void stats_report(FILE *stream) {
+    if (!isEnabled) {
+        return;
+    }
+    stats_enter_phase(PHASE_NONE);
+
+    Figures total;
+    memset(&total, 0, sizeof(total));
+    fprintf(stream, "%-6s %12s %12s %16s %16s %14s\n", "phase", "wall_ms",
+            "cpu_ms", "cycles", "instructions", "cache_misses");
+    for (int phase = 0; phase <= PHASE_COUNT; phase++) {
+        Figures *figures = phase < PHASE_COUNT ? &phases[phase] :
+                &total;
+        fprintf(stream, "%-6s %12.3f %12.3f", phase < PHASE_COUNT ?
+                phaseNames[phase] : "total", figures->wallTime,
+                figures->cpuTime);
+        if (hasCounters) {
+            fprintf(stream, " %16llu %16llu %14llu\n",
+                    (unsigned long long) figures->events[0],
+                    (unsigned long long) figures->events[1],
+                    (unsigned long long) figures->events[2]);
+        } else {
+            fprintf(stream, " %16s %16s %14s\n", "-", "-", "-");
+        }
+
+        if (phase < PHASE_COUNT) {
+            total.wallTime += figures->wallTime;
+            total.cpuTime += figures->cpuTime;
+            for (int i = 0; i < HARDWARE_COUNTERS; i++) {
+                total.events[i] += figures->events[i];
+            }
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stream, "words_scanned %ld\n", counts[COUNT_WORDS_SCANNED]);
+    fprintf(stream, "words_rejected_early %ld\n",
+            counts[COUNT_WORDS_REJECTED]);
+    fprintf(stream, "bytes_read %ld\n", counts[COUNT_BYTES_READ]);
+    fprintf(stream, "peak_rss_kb %ld\n", usage.ru_maxrss);
+    if (!hasCounters) {
+        fprintf(stream, "hardware counters unavailable\n");
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* The parts of a search that -stats times separately */
+typedef enum {
+    PHASE_LOAD, PHASE_MATCH, PHASE_SORT, PHASE_PRINT, PHASE_COUNT,
+    PHASE_NONE = PHASE_COUNT
+} StatsPhase;
+
+/* The things -stats counts */
+typedef enum {
+    COUNT_WORDS_SCANNED, /* words a pattern was tested against */
+    COUNT_WORDS_REJECTED, /* words ruled out before any pattern test */
+    COUNT_BYTES_READ,
+    COUNT_TOTAL
+} StatsCount;
+
+/**
+ * Turns on statistics for the rest of the run. Until this is called the
+ * other stats functions do nothing, so they cost nothing to leave in.
+ * Hardware counters are opened if the kernel allows it.
+ *
+ * Returns nothing
+ * */
+void stats_enable();
+
+/**
+ * Tells whether statistics were turned on, so hot loops can skip
+ * gathering counts nobody will see.
+ *
+ * Returns true once stats_enable() has been called
+ * */
+bool stats_is_enabled();
+
+/**
+ * Charges the time and counter events from now on to a phase, ending the
+ * phase that was running. A phase can be entered many times and its
+ * figures add up.
+ *
+ * Parameters:
+ *  phase - the phase now running, PHASE_NONE to stop charging
+ *
+ * Returns nothing
+ * */
+void stats_enter_phase(StatsPhase phase);
+
+/**
+ * Adds to one of the counts. Safe to call from several threads.
+ *
+ * Parameters:
+ *  count - what is being counted
+ *  amount - how much to add
+ *
+ * Returns nothing
+ * */
+void stats_add(StatsCount count, long amount);
+
+/**
+ * Ends the running phase and prints the figures gathered so far, along
+ * with the peak resident set size.
+ *
+ * Parameters:
+ *  stream - where to print, normally stderr
+ *
+ * Returns nothing
+ * */
+void stats_report(FILE *stream);
+
+#endif
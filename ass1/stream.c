@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "stream.h"
+#include "utils.h"
+#include "stats.h"
+
+/* Where a buffer is on its way from the reader to the emitter */
+typedef enum {
+    SLOT_FREE, SLOT_READY, SLOT_MATCHING, SLOT_MATCHED
+} SlotState;
+
+/* A buffer of the file and the matches found in it */
+typedef struct {
+    SlotState state;
+    long sequence; /* the buffer's place in the file */
+    DictionaryWords *words;
+    DictionaryWords *matches;
+} StreamSlot;
+
+/* What the reader, matchers and emitter share */
+typedef struct {
+    int fd;
+    StreamSlot *slots;
+    int slotCount;
+    long buffersRead;
+    bool isReadDone;
+    int readError; /* errno of a failed read, 0 if reading went well */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    WordPredicate predicate;
+    void *query;
+} Stream;
+
+/**
+ * Fills a buffer with as much of the file as fits, starting with what was
+ * left over from the last buffer, and keeps any unfinished last line back
+ * for the next one. The buffer grows if a single line doesn't fit.
+ *
+ * Parameters:
+ *  stream - the stream being read
+ *  words - the dictionary whose arena is the buffer
+ *  carry - the unfinished line, updated for the next buffer
+ *  carrySize - the length of the unfinished line, updated too
+ *
+ * Returns true once the end of the file is reached, or reading failed
+ * and stream->readError is set
+ * */
+static bool fill_buffer(Stream *stream, DictionaryWords *words, char **carry,
+        size_t *carrySize) {
+    if (words->arenaMemsize < *carrySize + STREAM_BUFFER_SIZE) {
+        words->arenaMemsize = *carrySize + STREAM_BUFFER_SIZE;
+        words->arena = (char*) realloc(words->arena, words->arenaMemsize);
+    }
+    if (*carrySize) {
+        memcpy(words->arena, *carry, *carrySize);
+    }
+    size_t used = *carrySize;
+    bool isEnd = false;
+    char *lastNewline = NULL;
+
+    while (!isEnd && lastNewline == NULL) {
+        while (used < words->arenaMemsize) {
+            ssize_t got = read(stream->fd, words->arena + used,
+                    words->arenaMemsize - used);
+            if (got == -1 && errno == EINTR) {
+                continue;
+            }
+            if (got == -1) {
+                stream->readError = errno;
+            }
+            if (got <= 0) {
+                isEnd = true;
+                break;
+            }
+            used += got;
+            stats_add(COUNT_BYTES_READ, got);
+        }
+        lastNewline = memrchr(words->arena, '\n', used);
+        if (lastNewline == NULL && !isEnd) {
+            words->arenaMemsize *= 2;
+            words->arena = (char*) realloc(words->arena,
+                    words->arenaMemsize);
+        }
+    }
+
+    /* A last line without a newline is not a word, as when loading */
+    size_t end = lastNewline ? lastNewline + 1 - words->arena : 0;
+    *carrySize = used - end;
+    *carry = (char*) realloc(*carry, *carrySize + 1);
+    memcpy(*carry, words->arena + end, *carrySize);
+    words->arenaSize = end;
+    return isEnd;
+}
+
+/**
+ * The reader thread: fills free buffers in file order until the end of
+ * the file.
+ *
+ * Parameters:
+ *  arg - the stream
+ *
+ * Returns nothing
+ * */
+static void *read_buffers(void *arg) {
+    Stream *stream = (Stream*) arg;
+    char *carry = NULL;
+    size_t carrySize = 0;
+    bool isEnd = false;
+
+    while (!isEnd) {
+        pthread_mutex_lock(&stream->lock);
+        StreamSlot *slot = NULL;
+        while (slot == NULL) {
+            for (int i = 0; i < stream->slotCount && slot == NULL; i++) {
+                if (stream->slots[i].state == SLOT_FREE) {
+                    slot = &stream->slots[i];
+                }
+            }
+            if (slot == NULL) {
+                pthread_cond_wait(&stream->changed, &stream->lock);
+            }
+        }
+        /* Only the reader takes free slots, so it can fill it unlocked */
+        pthread_mutex_unlock(&stream->lock);
+
+        isEnd = fill_buffer(stream, slot->words, &carry, &carrySize);
+
+        pthread_mutex_lock(&stream->lock);
+        slot->sequence = stream->buffersRead++;
+        slot->state = SLOT_READY;
+        stream->isReadDone = isEnd;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+    }
+
+    free(carry);
+    return NULL;
+}
+
+/**
+ * A matcher thread: splits and tests the words of ready buffers, earliest
+ * first, until the reader is done and no buffer is left.
+ *
+ * Parameters:
+ *  arg - the stream
+ *
+ * Returns nothing
+ * */
+static void *match_buffers(void *arg) {
+    Stream *stream = (Stream*) arg;
+
+    pthread_mutex_lock(&stream->lock);
+    while (true) {
+        StreamSlot *slot = NULL;
+        for (int i = 0; i < stream->slotCount; i++) {
+            if (stream->slots[i].state == SLOT_READY && (slot == NULL ||
+                    stream->slots[i].sequence < slot->sequence)) {
+                slot = &stream->slots[i];
+            }
+        }
+        if (slot == NULL) {
+            if (stream->isReadDone) {
+                break;
+            }
+            pthread_cond_wait(&stream->changed, &stream->lock);
+            continue;
+        }
+        slot->state = SLOT_MATCHING;
+        pthread_mutex_unlock(&stream->lock);
+
+        DictionaryWords *words = slot->words;
+        words->size = 0;
+        dict_words_split_arena(words);
+        dict_words_normalize(words);
+        stats_add(COUNT_WORDS_SCANNED, words->size);
+        slot->matches->size = 0;
+        for (int id = 0; id < words->size; id++) {
+            if (stream->predicate(words, id, stream->query)) {
+                dict_words_add_id(slot->matches, id);
+            }
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        slot->state = SLOT_MATCHED;
+        pthread_cond_broadcast(&stream->changed);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+bool stream_search(char *filename, WordPredicate predicate, void *query,
+        int threads, MatchEmitter emit, void *context) {
+    Stream stream;
+    stream.fd = open(filename, O_RDONLY);
+    if (stream.fd == -1) {
+        return false;
+    }
+    posix_fadvise(stream.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    stream.slotCount = threads * STREAM_BUFFERS_PER_THREAD + 1;
+    stream.slots = (StreamSlot*) malloc(stream.slotCount *
+            sizeof(StreamSlot));
+    for (int i = 0; i < stream.slotCount; i++) {
+        stream.slots[i].state = SLOT_FREE;
+        stream.slots[i].words = dict_words_init();
+        stream.slots[i].matches = dict_words_init_matches(
+                stream.slots[i].words);
+    }
+    stream.buffersRead = 0;
+    stream.isReadDone = false;
+    stream.readError = 0;
+    pthread_mutex_init(&stream.lock, NULL);
+    pthread_cond_init(&stream.changed, NULL);
+    stream.predicate = predicate;
+    stream.query = query;
+
+    pthread_t reader;
+    pthread_t *matchers = (pthread_t*) malloc(threads * sizeof(pthread_t));
+    pthread_create(&reader, NULL, read_buffers, &stream);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&matchers[i], NULL, match_buffers, &stream);
+    }
+
+    /* Emit each buffer's matches in file order, then free its slot */
+    pthread_mutex_lock(&stream.lock);
+    for (long next = 0; !stream.isReadDone || next < stream.buffersRead;) {
+        StreamSlot *slot = NULL;
+        for (int i = 0; i < stream.slotCount; i++) {
+            if (stream.slots[i].state == SLOT_MATCHED &&
+                    stream.slots[i].sequence == next) {
+                slot = &stream.slots[i];
+            }
+        }
+        if (slot == NULL) {
+            pthread_cond_wait(&stream.changed, &stream.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&stream.lock);
+
+        emit(slot->matches, context);
+
+        pthread_mutex_lock(&stream.lock);
+        slot->state = SLOT_FREE;
+        next++;
+        pthread_cond_broadcast(&stream.changed);
+    }
+    pthread_mutex_unlock(&stream.lock);
+
+    pthread_join(reader, NULL);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(matchers[i], NULL);
+    }
+    for (int i = 0; i < stream.slotCount; i++) {
+        dict_words_free(stream.slots[i].matches);
+        dict_words_free(stream.slots[i].words);
+    }
+    free(matchers);
+    free(stream.slots);
+    pthread_mutex_destroy(&stream.lock);
+    pthread_cond_destroy(&stream.changed);
+    close(stream.fd);
+    if (stream.readError) {
+        errno = stream.readError;
+        return false;
+    }
+    return true;
+}
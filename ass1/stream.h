@@ -0,0 +1,39 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "scan.h"
+
+/* How many bytes of the file the reader hands over at a time */
+#define STREAM_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* Buffers in flight per matcher thread, so the reader can stay ahead */
+#define STREAM_BUFFERS_PER_THREAD 2
+
+/* Receives the matches of one buffer, in the order of the file */
+typedef void (*MatchEmitter)(DictionaryWords *matches, void *context);
+
+/**
+ * Searches a word file without loading all of it. A reader thread fills
+ * fixed size buffers with whole lines, matcher threads split and test the
+ * words of each buffer, and the calling thread hands each buffer's
+ * matches to the emitter in file order as soon as they are ready. Memory
+ * use is bounded by the number of buffers, whatever the size of the file.
+ *
+ * Parameters:
+ *  filename - the word file to search
+ *  predicate - the test for a single word, given a buffer's dictionary
+ *  query - passed to the predicate untouched
+ *  threads - the number of matcher threads
+ *  emit - receives the matches of each buffer
+ *  context - passed to the emitter untouched
+ *
+ * Returns false with errno set if the file could not be opened or read.
+ * The matches of what was read before a read error are still emitted.
+ * */
+bool stream_search(char *filename, WordPredicate predicate, void *query,
+        int threads, MatchEmitter emit, void *context);
+
+#endif
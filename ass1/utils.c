@@ -1,57 +1,226 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <strings.h>
+#include <sys/mman.h>
 
 #include "utils.h"
+#include "letterindex.h"
+#include "dawg.h"
+#include "fmindex.h"
 
-int compare_words(const void *firstWord, const void *secondWord) {
-    return strcasecmp(*(char**) firstWord, *(char**) secondWord);
-}
+/* The number of entries and arena bytes a new dictionary starts with */
+#define INITIAL_ENTRIES 64
+#define INITIAL_ARENA_SIZE 1024
 
-char *read_line(FILE *file, int readChunk) {
-    int chunkSize = readChunk;
-    int characterPosition = 0;
-    char *line = malloc(readChunk);
-    int charRead;
-    while ((charRead = fgetc(file)) != '\n') {
-        if (charRead == EOF) {
-            return NULL; // indicate we are done reading
-        }
-        line[characterPosition++] = charRead;
-        if (characterPosition == chunkSize) {
-            chunkSize += readChunk;
-            line = realloc(line, chunkSize);
-        }
-    }
-    line[characterPosition] = 0;
-
-    return line;
+int compare_ids(const void *firstId, const void *secondId) {
+    return *(int*) firstId - *(int*) secondId;
 }
 
 DictionaryWords *dict_words_init() {
     DictionaryWords *dict = (DictionaryWords*) malloc(sizeof(DictionaryWords));
-    dict->words = (char**) malloc(sizeof(char*));
-    dict->size = 0;
-    dict->memsize = sizeof(char*);
+    memset(dict, 0, sizeof(DictionaryWords));
+    dict->arena = (char*) malloc(INITIAL_ARENA_SIZE);
+    dict->arenaMemsize = INITIAL_ARENA_SIZE;
 
     return dict;
 }
 
-void dict_words_add(DictionaryWords *dict, char *word) {
-    dict->words[dict->size] = word;
-    int newSize = dict->memsize + sizeof(char*);
-    dict->memsize = newSize;
-    dict->words = (char**) realloc(dict->words, newSize);
+DictionaryWords *dict_words_init_matches(DictionaryWords *source) {
+    DictionaryWords *matches = (DictionaryWords*) malloc(
+            sizeof(DictionaryWords));
+    memset(matches, 0, sizeof(DictionaryWords));
+    matches->source = source;
+
+    return matches;
+}
+
+void dict_words_reserve(DictionaryWords *dict, int count) {
+    if (count <= dict->memsize) {
+        return;
+    }
+    int newMemsize = dict->memsize ? dict->memsize : INITIAL_ENTRIES;
+    while (newMemsize < count) {
+        newMemsize *= 2;
+    }
+    dict->memsize = newMemsize;
+
+    if (dict->source != NULL) {
+        dict->ids = (int*) realloc(dict->ids, newMemsize * sizeof(int));
+    } else {
+        dict->offsets = (size_t*) realloc(dict->offsets,
+                newMemsize * sizeof(size_t));
+        dict->wordInfo = (uint32_t*) realloc(dict->wordInfo,
+                newMemsize * sizeof(uint32_t));
+    }
+}
+
+void dict_words_add(DictionaryWords *dict, const char *word, int length) {
+    if (dict->arenaSize + length + 1 > dict->arenaMemsize) {
+        size_t newArenaSize = dict->arenaMemsize * 2;
+        while (newArenaSize < dict->arenaSize + length + 1) {
+            newArenaSize *= 2;
+        }
+        dict->arena = (char*) realloc(dict->arena, newArenaSize);
+        dict->arenaMemsize = newArenaSize;
+    }
+    dict_words_reserve(dict, dict->size + 1);
+
+    memcpy(dict->arena + dict->arenaSize, word, length);
+    dict->arena[dict->arenaSize + length] = 0;
+    dict->offsets[dict->size] = dict->arenaSize;
+    dict->wordInfo[dict->size] = length;
+    dict->arenaSize += length + 1;
     dict->size++;
 }
 
+void dict_words_add_id(DictionaryWords *matches, int id) {
+    dict_words_reserve(matches, matches->size + 1);
+    matches->ids[matches->size++] = id;
+}
+
+void dict_words_split_arena(DictionaryWords *dict) {
+    const char *end = dict->arena + dict->arenaSize;
+
+    /* Count the words first so the entries are allocated only once */
+    int wordCount = 0;
+    for (const char *line = dict->arena; (line = memchr(line, '\n',
+            end - line));
+            line++) {
+        wordCount++;
+    }
+    dict_words_reserve(dict, dict->size + wordCount);
+
+    const char *word = dict->arena;
+    const char *newline;
+    while ((newline = memchr(word, '\n', end - word))) {
+        dict->offsets[dict->size] = word - dict->arena;
+        dict->wordInfo[dict->size] = newline - word;
+        dict->size++;
+        word = newline + 1;
+    }
+}
+
+void dict_words_normalize(DictionaryWords *dict) {
+    free(dict->folded);
+    dict->folded = (char*) malloc(dict->arenaSize + 1);
+    dict->folded[dict->arenaSize] = 0;
+    const unsigned char *arena = (unsigned char*) dict->arena;
+    unsigned char *folded = (unsigned char*) dict->folded;
+    for (size_t i = 0; i < dict->arenaSize; i++) {
+        /* Only 'A' to 'Z' get the case bit, as tolower() does */
+        folded[i] = arena[i] | ((unsigned char) (arena[i] - 'A') < 26) << 5;
+    }
+
+    dict->letterSigs = (uint32_t*) realloc(dict->letterSigs,
+            (dict->size + 1) * sizeof(uint32_t));
+    for (int id = 0; id < dict->size; id++) {
+        const unsigned char *word = folded + dict->offsets[id];
+        uint32_t length = dict->wordInfo[id] & WORD_LENGTH_MASK;
+        uint32_t i = 0;
+        uint32_t letters = 0;
+        while (i < length && (unsigned char) (word[i] - 'a') < 26) {
+            letters |= 1u << (word[i] - 'a');
+            i++;
+        }
+        /* Ends the word where the arena has its newline */
+        folded[dict->offsets[id] + length] = 0;
+        dict->wordInfo[id] = i == length ? length | WORD_ALPHA_BIT : length;
+        dict->letterSigs[id] = letters;
+    }
+}
+
+void dict_words_index_lengths(DictionaryWords *dict) {
+    int maxLength = 0;
+    for (int i = 0; i < dict->size; i++) {
+        int length = dict->wordInfo[i] & WORD_LENGTH_MASK;
+        if (length > maxLength) {
+            maxLength = length;
+        }
+    }
+
+    /* Counting sort of the ids by length, which keeps each group in
+     * dictionary order */
+    int *starts = (int*) calloc(maxLength + 2, sizeof(int));
+    for (int i = 0; i < dict->size; i++) {
+        starts[(dict->wordInfo[i] & WORD_LENGTH_MASK) + 1]++;
+    }
+    for (int length = 0; length <= maxLength; length++) {
+        starts[length + 1] += starts[length];
+    }
+
+    int *next = (int*) malloc((maxLength + 1) * sizeof(int));
+    memcpy(next, starts, (maxLength + 1) * sizeof(int));
+    free(dict->lengthIds);
+    dict->lengthIds = (int*) malloc((dict->size + 1) * sizeof(int));
+    for (int i = 0; i < dict->size; i++) {
+        dict->lengthIds[next[dict->wordInfo[i] & WORD_LENGTH_MASK]++] = i;
+    }
+    free(next);
+
+    free(dict->lengthStarts);
+    dict->lengthStarts = starts;
+    dict->maxWordLength = maxLength;
+}
+
+char *dict_words_get(DictionaryWords *dict, int index) {
+    if (dict->source != NULL) {
+        return dict->source->arena + dict->source->offsets[dict->ids[index]];
+    }
+    return dict->arena + dict->offsets[index];
+}
+
+int dict_words_length(DictionaryWords *dict, int index) {
+    if (dict->source != NULL) {
+        return dict->source->wordInfo[dict->ids[index]] & WORD_LENGTH_MASK;
+    }
+    return dict->wordInfo[index] & WORD_LENGTH_MASK;
+}
+
 void dict_words_free(DictionaryWords *dict) {
-    if (dict->words != NULL) {
-        free(dict->words);
+    if (dict == NULL) {
+        return;
     }
-    if (dict != NULL) {
+    if (dict->indexMapping != NULL) {
+        /* Of a mapped structure only the struct itself was allocated */
+        if (!dict->isSortMapped) {
+            free(dict->sortRanks);
+            free(dict->sortedIds);
+        }
+        if (dict->isLetterIndexMapped) {
+            free(dict->letterIndex);
+        } else {
+            letter_index_free(dict->letterIndex);
+        }
+        if (dict->isDawgMapped) {
+            free(dict->dawg);
+        } else {
+            dawg_free(dict->dawg);
+        }
+        if (dict->isFmIndexMapped) {
+            free(dict->fmIndex);
+        } else {
+            fm_index_free(dict->fmIndex);
+        }
+        munmap(dict->indexMapping, dict->indexMappingSize);
         free(dict);
-        dict = NULL;
+        return;
+    }
+    if (dict->isArenaMapped) {
+        munmap(dict->arena, dict->arenaSize);
+    } else {
+        free(dict->arena);
     }
+    free(dict->offsets);
+    free(dict->wordInfo);
+    free(dict->folded);
+    free(dict->letterSigs);
+    free(dict->ids);
+    free(dict->lengthStarts);
+    free(dict->lengthIds);
+    free(dict->sortRanks);
+    free(dict->sortedIds);
+    letter_index_free(dict->letterIndex);
+    dawg_free(dict->dawg);
+    fm_index_free(dict->fmIndex);
+    free(dict);
 }
@@ -1,57 +1,159 @@
-#include <string.h>
-#include <stdlib.h>
+#ifndef UTILS_H_
+#define UTILS_H_
+
 #include <stdio.h>
-#include <strings.h>
-
-#include "utils.h"
-
-int compare_words(const void *firstWord, const void *secondWord) {
-    return strcasecmp(*(char**) firstWord, *(char**) secondWord);
-}
-
-char *read_line(FILE *file, int readChunk) {
-    int chunkSize = readChunk;
-    int characterPosition = 0;
-    char *line = malloc(readChunk);
-    int charRead;
-    while ((charRead = fgetc(file)) != '\n') {
-        if (charRead == EOF) {
-            return NULL; // indicate we are done reading
-        }
-        line[characterPosition++] = charRead;
-        if (characterPosition == chunkSize) {
-            chunkSize += readChunk;
-            line = realloc(line, chunkSize);
-        }
-    }
-    line[characterPosition] = 0;
-
-    return line;
-}
-
-DictionaryWords *dict_words_init() {
-    DictionaryWords *dict = (DictionaryWords*) malloc(sizeof(DictionaryWords));
-    dict->words = (char**) malloc(sizeof(char*));
-    dict->size = 0;
-    dict->memsize = sizeof(char*);
-
-    return dict;
-}
-
-void dict_words_add(DictionaryWords *dict, char *word) {
-    dict->words[dict->size] = word;
-    int newSize = dict->memsize + sizeof(char*);
-    dict->memsize = newSize;
-    dict->words = (char**) realloc(dict->words, newSize);
-    dict->size++;
-}
-
-void dict_words_free(DictionaryWords *dict) {
-    if (dict->words != NULL) {
-        free(dict->words);
-    }
-    if (dict != NULL) {
-        free(dict);
-        dict = NULL;
-    }
-}
+
+#include "common.h"
+
+
+/**
+ *  Compares two word ids numerically, for putting matches back
+ *  into dictionary order with qsort()
+ *
+ * Parameters:
+ *  firstId - a pointer to the first id
+ *  secondId - a pointer to the second id
+ * Returns: less than, equal to or greater than 0 like strcmp
+ */
+int compare_ids(const void *firstId, const void *secondId);
+
+/**
+ * Initialises a new dictionary structure that will grow with words added to it.
+ *
+ * Parameters:
+ *  None
+ *
+ *  Returns a pointer to a structure containing the dictionary
+ *
+ * */
+DictionaryWords *dict_words_init();
+
+/**
+ * Initialises an empty set of matches. The set only holds ids of
+ * words in the source dictionary, it never copies them.
+ *
+ * Parameters:
+ *  source - the dictionary the matched ids refer to
+ *
+ *  Returns a pointer to the empty match set
+ *
+ * */
+DictionaryWords *dict_words_init_matches(DictionaryWords *source);
+
+/**
+ *  Makes sure there is room for at least count entries. Storage grows
+ *  by doubling so adding words one at a time stays cheap.
+ *
+ * Paramaters:
+ * dict - the dictionary or match set to grow
+ * count - the number of entries needed
+ *
+ * Returns nothing
+ *
+ * */
+void dict_words_reserve(DictionaryWords *dict, int count);
+
+/**
+ *  Dynamically add a new word to the dictionary, copying it into the
+ *  arena. The dictionary must own its arena.
+ * 
+ * Paramaters:
+ * dict - the dictionary to add to
+ * word - the word to add
+ * length - the length of the word
+ *
+ * Returns void, nada
+ * 
+ * */
+void dict_words_add(DictionaryWords *dict, const char *word, int length);
+
+/**
+ *  Adds the id of a matched word to a match set
+ *
+ * Paramaters:
+ * matches - the match set to add to
+ * id - the id of the word in the source dictionary
+ *
+ * Returns nothing
+ *
+ * */
+void dict_words_add_id(DictionaryWords *matches, int id);
+
+/**
+ *  Turns the lines in the arena into words by recording the offset and
+ *  length of each. The arena is only read, so it may be a read only
+ *  mapping. A trailing line with no newline is not treated as a word.
+ *
+ * Paramaters:
+ * dict - the dictionary whose arena holds the raw file contents
+ *
+ * Returns nothing
+ *
+ * */
+void dict_words_split_arena(DictionaryWords *dict);
+
+/**
+ *  Makes the lower case copy of the arena with each word null
+ *  terminated, marks the words that are all
+ *  letters in their wordInfo and records the letters of each word in
+ *  letterSigs, so searches don't redo any of it for every word of every
+ *  query. Call again after adding words.
+ *
+ * Paramaters:
+ * dict - the dictionary to normalize
+ *
+ * Returns nothing
+ *
+ * */
+void dict_words_normalize(DictionaryWords *dict);
+
+/**
+ *  Groups the word ids by length so searches can skip words that are
+ *  too short or too long to match. Call again after adding words.
+ *
+ * Paramaters:
+ * dict - the dictionary to index
+ *
+ * Returns nothing
+ *
+ * */
+void dict_words_index_lengths(DictionaryWords *dict);
+
+/**
+ *  Gets a word from a dictionary or a match set
+ *
+ * Paramaters:
+ * dict - the dictionary or match set
+ * index - the position of the word
+ *
+ * Returns the word, which is dict_words_length() long and not null
+ * terminated
+ *
+ * */
+char *dict_words_get(DictionaryWords *dict, int index);
+
+/**
+ *  Gets the length of a word in a dictionary or a match set
+ *
+ * Paramaters:
+ * dict - the dictionary or match set
+ * index - the position of the word
+ *
+ * Returns the length of the word
+ *
+ * */
+int dict_words_length(DictionaryWords *dict, int index);
+
+/**
+ * Free all the memory resources used by the dictionary,
+ * including the arena or the index file it was loaded from.
+ * A match set never frees its source.
+ *
+ * Parameters:
+ * dict - The dictionary to free
+ *
+ * Returns absolutely nothing
+ * */
+void dict_words_free(DictionaryWords *dict);
+
+#endif